@@ -0,0 +1,155 @@
+#pragma once
+
+#include "Registry.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+namespace cmc {
+
+// Shared pointer into containerFor<T>(), the container of T on the calling
+// thread. The container is implied by the type and slots never move, so the
+// pointer is a 4-byte slot and needs no registration: copying it only
+// increments the reference count. It must stay on the thread that created it.
+//
+// The low 24 bits hold the slot and the high 8 bits the low bits of its
+// generation, so a pointer whose object was destroyed by clear(), load(),
+// extract() or destroy(handle) is detected even once the slot is reused,
+// unless the slot was reused a multiple of 256 times. Accessing such a
+// pointer throws std::logic_error; copying or resetting it does nothing.
+template<class T>
+class CompactPtr final {
+public:
+    static const unsigned int kNull = ~0U;
+    static const unsigned int kSlotBits = 24;
+    static const unsigned int kSlotMask = (1U << kSlotBits) - 1;
+
+    CompactPtr()
+    : ref_(kNull)
+    {}
+
+    CompactPtr(const CompactPtr<T>& obj)
+    : ref_(obj.ref_)
+    {
+        if ((ref_ != kNull) && isLive()) {
+            containerFor<T>().retainSlot(getSlot());
+        }
+    }
+
+    CompactPtr(CompactPtr<T>&& obj)
+    : ref_(obj.ref_)
+    {
+        obj.ref_ = kNull;
+    }
+
+    template<typename A> CompactPtr(A) = delete;
+
+    ~CompactPtr() {
+        static_assert(sizeof(CompactPtr<T>) == sizeof(unsigned int), "cmc::CompactPtr must stay a single index");
+
+        reset();
+    }
+
+    // Throws std::length_error when the slot does not fit in 24 bits.
+    template<typename... Args>
+    static CompactPtr<T> make(Args&&... args) {
+        Container<T>& c = containerFor<T>();
+        unsigned int slot = c.emplaceObject(1U, std::forward<Args>(args)...);
+
+        if (slot >= kSlotMask) {
+            c.eraseElement(slot);
+            throw std::length_error("cmc::CompactPtr slot does not fit in 24 bits");
+        }
+
+        return CompactPtr<T>(slot | (pack(c.slots_.getGeneration(slot)) << kSlotBits), 0);
+    }
+
+    T* operator->() const {
+        if ((ref_ == kNull) || !isLive()) {
+            throw std::logic_error("cmc::CompactPtr references a destroyed object");
+        }
+
+        Container<T>& c = containerFor<T>();
+        return &(c.objects_[c.slots_.getOffset(getSlot())]);
+    }
+
+    T& operator*() const {
+        return *(operator->());
+    }
+
+    bool isNull() const {
+        return ref_ == kNull;
+    }
+
+    unsigned int getSlot() const {
+        return ref_ & kSlotMask;
+    }
+
+    // When the thread exits, the container is marked as gone before it
+    // destroys its objects, so the pointers they hold release nothing.
+    void reset() {
+        if (ref_ != kNull) {
+            if (hasContainerFor<T>() && isLive()) {
+                containerFor<T>().releaseSlot(getSlot());
+            }
+        }
+
+        ref_ = kNull;
+    }
+
+    const CompactPtr<T>& operator=(const CompactPtr<T>& obj) {
+        CompactPtr<T> tmp(obj);
+        std::swap(ref_, tmp.ref_);
+
+        return *this;
+    }
+
+    const CompactPtr<T>& operator=(CompactPtr<T>&& obj) {
+        if (this != &obj) {
+            reset();
+            std::swap(ref_, obj.ref_);
+        }
+
+        return *this;
+    }
+
+    bool operator==(const CompactPtr<T>& obj) const {
+        return ref_ == obj.ref_;
+    }
+
+    bool operator!=(const CompactPtr<T>& obj) const {
+        return ref_ != obj.ref_;
+    }
+
+private:
+    // Adopts the reference the object was created with.
+    explicit CompactPtr(unsigned int ref, int)
+    : ref_(ref)
+    {}
+
+    static unsigned int pack(unsigned int generation) {
+        return generation & (kNull >> kSlotBits);
+    }
+
+    // A bounds check and a generation compare, kept in release builds.
+    bool isLive() const {
+        const Container<T>& c = containerFor<T>();
+        unsigned int slot = getSlot();
+
+        bool live = (slot < c.slots_.getSlotOffsets().size()) &&
+                    (pack(c.slots_.getGeneration(slot)) == (ref_ >> kSlotBits));
+
+        assert((!live || c.isUsedSlot(slot)) && "cmc::CompactPtr references a free slot");
+
+        return live;
+    }
+
+    unsigned int ref_;
+};
+
+template<class T> const unsigned int CompactPtr<T>::kNull;
+template<class T> const unsigned int CompactPtr<T>::kSlotBits;
+template<class T> const unsigned int CompactPtr<T>::kSlotMask;
+
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include "Handle.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace cmc {
+
+// Container shared by several threads. Between two calls to sync() the
+// object array and the slot tables never change shape, so get() is wait-free
+// and retain()/release() are single atomic operations. Creations and
+// destructions are recorded by per-thread writers and applied by sync(),
+// which must run while no other thread uses the container.
+template<class T>
+class ConcurrentContainer final {
+public:
+    static const unsigned int kFreeSlot = ~0U;
+
+    class Writer final {
+    public:
+        friend ConcurrentContainer<T>;
+
+        // The handle becomes usable once sync() has created the object. The
+        // object starts with one reference owned by the caller.
+        template<typename... Args>
+        Handle<T> make(Args&&... args) {
+            unsigned int slot = c_->reserveSlot();
+
+            createdSlots_.emplace_back(slot);
+            createdObjects_.emplace_back(std::forward<Args>(args)...);
+
+            return Handle<T>(slot, c_->getGeneration(slot));
+        }
+
+        // Stale handles, handles not created by sync() yet and objects whose
+        // count already reached zero are ignored.
+        void release(Handle<T> handle) {
+            if (!c_->isValid(handle)) {
+                return;
+            }
+
+            std::atomic<unsigned int>& refCount = c_->refCount_[handle.getIndex()];
+            unsigned int count = refCount.load(std::memory_order_relaxed);
+
+            do {
+                if (count == 0U) {
+                    return;
+                }
+            } while (!refCount.compare_exchange_weak(count, count - 1U, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+            if (count == 1U) {
+                releasedSlots_.emplace_back(handle.getIndex());
+            }
+        }
+
+    private:
+        explicit Writer(ConcurrentContainer<T>* c)
+        : c_(c)
+        {}
+
+        ConcurrentContainer<T>* c_;
+        std::vector<unsigned int> createdSlots_;
+        std::vector<T> createdObjects_;
+        std::vector<unsigned int> releasedSlots_;
+    };
+
+    explicit ConcurrentContainer(unsigned int writerCount)
+    : freeCursor_(0U)
+    , nextSlot_(0U)
+    , refCapacity_(0U)
+    {
+        writers_.reserve(writerCount);
+
+        for (unsigned int i = 0; i < writerCount; ++i) {
+            writers_.emplace_back(Writer(this));
+        }
+    }
+
+    ConcurrentContainer(ConcurrentContainer<T>& obj) = delete;
+    ConcurrentContainer(ConcurrentContainer<T>&& obj) = delete;
+
+    template<typename A> ConcurrentContainer(A) = delete;
+
+    Writer& writer(unsigned int index) {
+        return writers_[index];
+    }
+
+    bool isValid(Handle<T> handle) const {
+        return  (handle.getIndex() < slotGeneration_.size()) &&
+                (slotGeneration_[handle.getIndex()] == handle.getGeneration()) &&
+                (slotOffset_[handle.getIndex()] != kFreeSlot);
+    }
+
+    T* get(Handle<T> handle) {
+        if (!isValid(handle)) {
+            return nullptr;
+        }
+
+        return &(objects_[slotOffset_[handle.getIndex()]]);
+    }
+
+    const T* get(Handle<T> handle) const {
+        if (!isValid(handle)) {
+            return nullptr;
+        }
+
+        return &(objects_[slotOffset_[handle.getIndex()]]);
+    }
+
+    // Like Writer::release(), ignores invalid handles and objects already
+    // released, which sync() destroys anyway.
+    void retain(Handle<T> handle) {
+        if (!isValid(handle)) {
+            return;
+        }
+
+        std::atomic<unsigned int>& refCount = refCount_[handle.getIndex()];
+        unsigned int count = refCount.load(std::memory_order_relaxed);
+
+        do {
+            if (count == 0U) {
+                return;
+            }
+        } while (!refCount.compare_exchange_weak(count, count + 1U, std::memory_order_relaxed));
+    }
+
+    unsigned int getRefCount(Handle<T> handle) const {
+        if (!isValid(handle)) {
+            return 0U;
+        }
+
+        return refCount_[handle.getIndex()].load(std::memory_order_relaxed);
+    }
+
+    // Applies every destruction and creation recorded by the writers.
+    void sync() {
+        growSlots(nextSlot_.load(std::memory_order_relaxed));
+
+        for (Writer& w : writers_) {
+            for (unsigned int slot : w.releasedSlots_) {
+                eraseSlot(slot);
+            }
+
+            w.releasedSlots_.clear();
+        }
+
+        size_t unused = (freeCursor_ < freeSlots_.size()) ? freeSlots_.size() - freeCursor_ : 0U;
+        freeSlots_.erase(freeSlots_.begin(), freeSlots_.end() - unused);
+        freeSlots_.insert(freeSlots_.end(), releasedSlots_.begin(), releasedSlots_.end());
+        releasedSlots_.clear();
+        freeCursor_.store(0U, std::memory_order_relaxed);
+
+        for (Writer& w : writers_) {
+            size_t count = w.createdSlots_.size();
+
+            for (size_t i = 0; i < count; ++i) {
+                unsigned int slot = w.createdSlots_[i];
+
+                slotOffset_[slot] = static_cast<unsigned int>(objects_.size());
+                objectSlot_.emplace_back(slot);
+                objects_.emplace_back(std::move(w.createdObjects_[i]));
+                refCount_[slot].store(1U, std::memory_order_relaxed);
+            }
+
+            w.createdSlots_.clear();
+            w.createdObjects_.clear();
+        }
+    }
+
+    size_t size() const {
+        return objects_.size();
+    }
+
+    template<typename F>
+    void forEach(F f) {
+        for (T& obj : objects_) {
+            f(obj);
+        }
+    }
+
+    const ConcurrentContainer<T>& operator=(const ConcurrentContainer<T>& obj) = delete;
+    bool operator==(const ConcurrentContainer<T>& obj) = delete;
+    bool operator!=(const ConcurrentContainer<T>& obj) = delete;
+
+private:
+    // Free slots are handed out in order through an atomic cursor and fresh
+    // slots through an atomic counter, so writers never wait for each other.
+    unsigned int reserveSlot() {
+        size_t index = freeCursor_.fetch_add(1U, std::memory_order_relaxed);
+
+        if (index < freeSlots_.size()) {
+            return freeSlots_[index];
+        }
+
+        return nextSlot_.fetch_add(1U, std::memory_order_relaxed);
+    }
+
+    unsigned int getGeneration(unsigned int slot) const {
+        return (slot < slotGeneration_.size()) ? slotGeneration_[slot] : 0U;
+    }
+
+    void growSlots(size_t count) {
+        if (count <= slotOffset_.size()) {
+            return;
+        }
+
+        slotOffset_.resize(count, kFreeSlot);
+        slotGeneration_.resize(count, 0U);
+
+        if (count > refCapacity_) {
+            size_t capacity = (count > 2 * refCapacity_) ? count : 2 * refCapacity_;
+            std::unique_ptr<std::atomic<unsigned int>[]> refCount(new std::atomic<unsigned int>[capacity]);
+
+            for (size_t i = 0; i < refCapacity_; ++i) {
+                refCount[i].store(refCount_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            for (size_t i = refCapacity_; i < capacity; ++i) {
+                refCount[i].store(0U, std::memory_order_relaxed);
+            }
+
+            refCount_ = std::move(refCount);
+            refCapacity_ = capacity;
+        }
+    }
+
+    // A slot released twice is only erased once.
+    void eraseSlot(unsigned int remSlot) {
+        if (slotOffset_[remSlot] == kFreeSlot) {
+            return;
+        }
+
+        size_t lastElem = objects_.size() - 1;
+        size_t remElem = slotOffset_[remSlot];
+
+        if (remElem != lastElem) {
+            objects_[remElem] = std::move(objects_[lastElem]);
+
+            unsigned int lastSlot = objectSlot_[lastElem];
+            objectSlot_[remElem] = lastSlot;
+            slotOffset_[lastSlot] = static_cast<unsigned int>(remElem);
+        }
+
+        objects_.pop_back();
+        objectSlot_.pop_back();
+
+        slotOffset_[remSlot] = kFreeSlot;
+        slotGeneration_[remSlot]++;
+        releasedSlots_.emplace_back(remSlot);
+    }
+
+    std::vector<Writer> writers_;
+    std::atomic<size_t> freeCursor_;
+    std::atomic<unsigned int> nextSlot_;
+    std::vector<unsigned int> freeSlots_;
+    std::vector<unsigned int> releasedSlots_;
+    std::vector<unsigned int> slotOffset_;
+    std::vector<unsigned int> slotGeneration_;
+    std::vector<unsigned int> objectSlot_;
+    std::unique_ptr<std::atomic<unsigned int>[]> refCount_;
+    size_t refCapacity_;
+    std::vector<T> objects_;
+};
+
+template<class T> const unsigned int ConcurrentContainer<T>::kFreeSlot;
+
+}
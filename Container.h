@@ -1,21 +1,83 @@
 #pragma once
 
+#include "ContainerObserver.h"
+#include "CycleCollector.h"
+#include "Handle.h"
+#include "MemoryResource.h"
+#include "SlotMap.h"
+#include "Snapshot.h"
+#include "Storage.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace cmc {
 
+template <class T> class CompactPtr;
+template <class T> class Journal;
 template <class T> class Ptr;
+template <class T> class Ref;
+template <class T> class WeakPtr;
 
 template<class T>
 class Container final {
 public:
+    friend CompactPtr<T>;
+    friend Journal<T>;
     friend Ptr<T>;
+    friend Ref<T>;
+    friend WeakPtr<T>;
+
+    typedef typename ContainerStorage<T>::type Storage;
+
+    static_assert(std::is_trivially_copyable<Handle<T>>::value, "Handle must stay trivially copyable");
 
     Container() = default;
     Container(Container<T>& obj) = delete;
     Container(Container<T>&& obj) = delete;
 
-    template<typename A> Container(A) = delete;
+    explicit Container(MemoryResource* resource)
+    : ptrAddress_(resource)
+    , ptrOffset_(resource)
+    , slots_(resource)
+    , refCount_(resource)
+    , objects_(resource)
+    , dirty_(resource)
+    , pending_(resource)
+    , handleOwned_(resource)
+    {}
+
+    // Fixed capacity mode: every internal array is allocated once here and
+    // exceeding the capacities throws std::length_error instead of growing.
+    // The dirty bits and the deferred destruction queue are reserved too, the
+    // queue for one entry per object. Observers, the state of incremental
+    // reordering and cycle collection, and the temporaries of bulk operations
+    // still use the global heap.
+    explicit Container(MemoryResource* resource, size_t capacity, size_t ptrCapacity)
+    : Container(resource)
+    {
+        reserve(capacity);
+
+        ptrAddress_.reserve(ptrCapacity);
+        ptrOffset_.reserve(ptrCapacity);
+        dirty_.reserve((capacity + 63) / 64);
+        pending_.reserve(capacity);
+
+        capacity_ = capacity;
+        ptrCapacity_ = ptrCapacity;
+    }
+
+    template<typename A, typename = typename std::enable_if<!std::is_convertible<A, MemoryResource*>::value>::type>
+    Container(A) = delete;
 
     ~Container() {
         invalidatePtrs();
@@ -23,33 +85,753 @@ public:
 
     template<typename... Args>
     Ptr<T> make(Args&&... args) {
-        objects_.emplace_back(T(std::forward<Args>(args)...));
-        refCount_.emplace_back(0U);
+        checkPtrCapacity(1);
 
-        unsigned int index = static_cast<unsigned int>(objects_.size() - 1);
+        unsigned int slot = emplaceObject(0U, std::forward<Args>(args)...);
 
-        ptrOffset_.emplace_back(index);
+        return ptrTo(slot);
+    }
 
-        Ptr<T> ptr(this, ptrOffset_.size() - 1);
+    template<typename... Args>
+    Handle<T> makeHandle(Args&&... args) {
+        unsigned int slot = emplaceObject(1U, std::forward<Args>(args)...);
+        handleOwned_[slot] = 1;
 
-        ptrAddress_.emplace_back(&ptr);
+        return Handle<T>(slot, slots_.getGeneration(slot));
+    }
+
+    void reserve(size_t count) {
+        checkCapacity(count);
+
+        objects_.reserve(count);
+        refCount_.reserve(count);
+        slots_.reserve(count);
+        handleOwned_.reserve(count);
+    }
+
+    template<typename... Args>
+    void makeN(std::vector<Ptr<T>>& out, size_t count, const Args&... args) {
+        reserveFor(out, count);
+
+        for (size_t i = 0; i < count; ++i) {
+            appendPtr(out, emplaceObject(0U, args...));
+        }
+    }
+
+    template<typename... Args>
+    void makeN(std::vector<Handle<T>>& out, size_t count, const Args&... args) {
+        reserve(objects_.size() + count);
+        out.reserve(out.size() + count);
+
+        for (size_t i = 0; i < count; ++i) {
+            unsigned int slot = emplaceObject(1U, args...);
+            handleOwned_[slot] = 1;
+            out.emplace_back(slot, slots_.getGeneration(slot));
+        }
+    }
+
+    template<typename It, typename F>
+    void makeFrom(It first, It last, F ctorFn, std::vector<Ptr<T>>& out) {
+        reserveFor(out, static_cast<size_t>(std::distance(first, last)));
+
+        for (; first != last; ++first) {
+            appendPtr(out, emplaceObject(0U, ctorFn(*first)));
+        }
+    }
+
+    bool isValid(Handle<T> handle) const {
+        return slots_.isValid(handle.getIndex(), handle.getGeneration());
+    }
+
+    T* get(Handle<T> handle) {
+        if (!isValid(handle)) {
+            return nullptr;
+        }
+
+        unsigned int eleIndex = slots_.getOffset(handle.getIndex());
+
+        if (trackDirty_) {
+            setDirty(eleIndex);
+        }
+
+        return &(objects_[eleIndex]);
+    }
+
+    const T* get(Handle<T> handle) const {
+        if (!isValid(handle)) {
+            return nullptr;
+        }
+
+        return &(objects_[slots_.getOffset(handle.getIndex())]);
+    }
+
+    // Ends the ownership of an object created with makeHandle(). The handle
+    // must hold the only reference to the object: while a Ptr references it,
+    // e.g. one returned by WeakPtr::lock(), or when it was created with make()
+    // and the handle only came from an index or forEachWithHandle(),
+    // std::logic_error is thrown and the object is kept.
+    void destroy(Handle<T> handle) {
+        if (!isValid(handle)) {
+            return;
+        }
+
+        checkSoleOwner(handle, "cmc::Container cannot destroy an object still referenced by a Ptr");
+
+        eraseElement(handle.getIndex());
+    }
+
+    void destroy(const std::vector<Handle<T>>& handles) {
+        for (Handle<T> handle : handles) {
+            destroy(handle);
+        }
+    }
+
+    // Releases every pointer of the vector at once. The pointers are left
+    // detached, so destroying them afterwards does no work.
+    void destroy(std::vector<Ptr<T>>& ptrs) {
+        std::vector<bool> deadPtrs(ptrAddress_.size(), false);
+        std::vector<bool> deadElems(objects_.size(), false);
+
+        for (Ptr<T>& ptr : ptrs) {
+            if (ptr.c_ != this) {
+                continue;
+            }
+
+            unsigned int eleIndex = getElementIndex(ptr.index_);
+
+            if (--refCount_[eleIndex] == 0) {
+                deadElems[eleIndex] = true;
+            }
+
+            deadPtrs[ptr.index_] = true;
+            ptr.c_ = nullptr;
+        }
+
+        for (size_t i = deadPtrs.size(); i-- > 0;) {
+            if (deadPtrs[i]) {
+                clearPointer(static_cast<unsigned int>(i));
+            }
+        }
+
+        eraseElements(deadElems);
+    }
+
+    // In deferred mode, an object whose last pointer is released stays in
+    // place with a zero reference count and its slot is queued, so releasing
+    // a pointer never moves memory or runs a destructor. Until collect() the
+    // object still counts in size() and its handles stay valid; a WeakPtr
+    // locked in between keeps it alive. Turning the mode off collects.
+    void setDeferredDestruction(bool deferred) {
+        if (!deferred) {
+            collect();
+        }
+
+        deferDestruction_ = deferred;
+    }
+
+    bool isDestructionDeferred() const {
+        return deferDestruction_;
+    }
+
+    size_t getPendingCount() const {
+        return pending_.size();
+    }
+
+    // Destroys the queued objects that are still unreferenced, compacting in
+    // a single backwards pass over the object array, and returns how many
+    // were destroyed. Objects released by their destructors are collected
+    // too.
+    size_t collect() {
+        size_t destroyed = 0;
+        std::vector<bool> deadElems;
+
+        while (!pending_.empty()) {
+            deadElems.assign(objects_.size(), false);
+
+            for (unsigned int slot : pending_) {
+                if (!isUsedSlot(slot)) {
+                    continue;
+                }
+
+                unsigned int eleIndex = slots_.getOffset(slot);
+
+                if ((refCount_[eleIndex] == 0) && !deadElems[eleIndex]) {
+                    deadElems[eleIndex] = true;
+                    destroyed++;
+                }
+            }
+
+            pending_.clear();
+            eraseElements(deadElems);
+        }
+
+        return destroyed;
+    }
+
+    // Destroys every object in one pass. All the pointers are invalidated and
+    // all the handles become stale.
+    void clear() {
+        checkStructuralChange();
+        invalidatePtrs();
+        epoch_++;
+
+        refCount_.clear();
+        slots_.clear();
+        objects_.clear();
+        dirty_.clear();
+        pending_.clear();
+        std::fill(handleOwned_.begin(), handleOwned_.end(), 0);
+
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onClear();
+        }
+    }
+
+    // Observers are notified of every change, in order, until removed.
+    void addObserver(ContainerObserver<T>* observer) {
+        observers_.emplace_back(observer);
+    }
+
+    void removeObserver(ContainerObserver<T>* observer) {
+        observers_.erase(std::remove(observers_.begin(), observers_.end(), observer), observers_.end());
+    }
+
+    // Objects are written through plain references, so writes the observers
+    // must see have to be reported explicitly.
+    void markWritten(Handle<T> handle) {
+        if (isValid(handle)) {
+            markDirty(handle);
+            notifyWrite(handle.getIndex());
+        }
+    }
+
+    void markWritten(const Ptr<T>& ptr) {
+        if (ptr.c_ == this) {
+            if (trackDirty_) {
+                setDirty(getElementIndex(ptr.index_));
+            }
+
+            notifyWrite(ptrOffset_[ptr.index_]);
+        }
+    }
+
+    // Dirty tracking keeps one bit per object, set when the object is created
+    // and whenever it is reached through a non-const get() or Ptr::operator->,
+    // so forEachDirty() can visit only the objects changed since the last
+    // clearDirty(). Writes through data() or parallelForEach() are not tracked.
+    void enableDirtyTracking() {
+        trackDirty_ = true;
+        dirty_.assign((objects_.size() + 63) / 64, 0);
+    }
+
+    void disableDirtyTracking() {
+        trackDirty_ = false;
+        dirty_.clear();
+    }
+
+    bool isDirty(Handle<T> handle) const {
+        return trackDirty_ && isValid(handle) && isDirtyAt(slots_.getOffset(handle.getIndex()));
+    }
+
+    void markDirty(Handle<T> handle) {
+        if (trackDirty_ && isValid(handle)) {
+            setDirty(slots_.getOffset(handle.getIndex()));
+        }
+    }
+
+    // Scans the bits a word at a time, so clean runs of 64 objects cost a
+    // single test.
+    template<typename F>
+    void forEachDirty(F f) {
+        size_t words = dirty_.size();
+
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t bits = dirty_[w];
+
+            while (bits != 0) {
+                size_t eleIndex = (w << 6) + static_cast<size_t>(__builtin_ctzll(bits));
+                f(objects_[eleIndex]);
+                bits &= bits - 1;
+            }
+        }
+    }
+
+    void clearDirty() {
+        std::fill(dirty_.begin(), dirty_.end(), 0);
+    }
 
-        return std::move(ptr);
+    // Moves the referenced objects out of the container, e.g. to hand them to
+    // the container of another thread with adopt(). Like destroy(handle), it
+    // throws std::logic_error, before moving anything, unless each handle
+    // holds the only reference to its object. The objects must not hold pointers into
+    // containers of the calling thread.
+    std::vector<T> extract(const std::vector<Handle<T>>& handles) {
+        for (Handle<T> handle : handles) {
+            if (isValid(handle)) {
+                checkSoleOwner(handle, "cmc::Container cannot extract an object still referenced by a Ptr");
+            }
+        }
+
+        std::vector<T> batch;
+        std::vector<bool> deadElems(objects_.size(), false);
+
+        batch.reserve(handles.size());
+
+        for (Handle<T> handle : handles) {
+            if (isValid(handle)) {
+                unsigned int eleIndex = slots_.getOffset(handle.getIndex());
+
+                if (!deadElems[eleIndex]) {
+                    deadElems[eleIndex] = true;
+                    batch.emplace_back(std::move(objects_[eleIndex]));
+                }
+            }
+        }
+
+        eraseElements(deadElems);
+
+        return batch;
+    }
+
+    // Moves a batch of objects in, each one owned by a new handle.
+    void adopt(std::vector<T>&& batch, std::vector<Handle<T>>& out) {
+        reserve(objects_.size() + batch.size());
+        out.reserve(out.size() + batch.size());
+
+        for (T& obj : batch) {
+            unsigned int slot = emplaceObject(1U, std::move(obj));
+            handleOwned_[slot] = 1;
+            out.emplace_back(slot, slots_.getGeneration(slot));
+        }
+
+        batch.clear();
+    }
+
+    // Writes the objects and the slot tables to a file that load() reads
+    // back. Pointers are not saved: objects should reference objects of other
+    // containers with handles, which stay valid once those containers are
+    // loaded too.
+    void save(const char* path) const {
+        static_assert(std::is_trivially_copyable<T>::value, "cmc::Container::save() needs trivially copyable objects");
+
+        detail::SnapshotHeader header = {};
+        header.magic = detail::kSnapshotMagic;
+        header.version = detail::kSnapshotVersion;
+        header.objectSize = sizeof(T);
+        header.objectAlign = alignof(T);
+        header.objectCount = objects_.size();
+        header.slotCount = slots_.getSlotOffsets().size();
+        header.freeCount = slots_.getFreeSlots().size();
+
+        detail::SnapshotWriter writer(path);
+
+        writer.write(&header, sizeof(header));
+        writer.pad();
+
+        forEachPageOf(objects_, [&writer](const T* first, size_t count) {
+            writer.write(first, count * sizeof(T));
+        });
+
+        writeArray(writer, slots_.getObjectSlots());
+        writeArray(writer, slots_.getSlotOffsets());
+        writeArray(writer, slots_.getSlotGenerations());
+        writeArray(writer, slots_.getFreeSlots());
+
+        writer.close();
+    }
+
+    // Replaces the content of the container with a snapshot written by
+    // save(). The file is mapped and every array is copied out of it with one
+    // bulk copy, so loading is linear in the size of the snapshot. Slots and
+    // generations are kept, so handles taken before saving are valid again.
+    // Pointers are not saved, so every object is owned by its handle with a
+    // reference count of 1. A snapshot that is truncated or whose tables do
+    // not agree throws std::runtime_error and leaves the container unchanged.
+    void load(const char* path) {
+        static_assert(std::is_trivially_copyable<T>::value, "cmc::Container::load() needs trivially copyable objects");
+        static_assert(alignof(T) <= detail::kSnapshotAlign, "cmc::Container::load() needs objects aligned to at most 64 bytes");
+
+        detail::MappedFile file(path);
+
+        detail::SnapshotHeader header;
+        if (file.size() < sizeof(header)) {
+            throw std::runtime_error("cmc: snapshot is truncated");
+        }
+
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if ((header.magic != detail::kSnapshotMagic) || (header.version != detail::kSnapshotVersion) ||
+            (header.objectSize != sizeof(T)) || (header.objectAlign != alignof(T))) {
+            throw std::runtime_error("cmc: snapshot does not match the object type");
+        }
+
+        if (header.slotCount >= Handle<T>::kInvalidIndex) {
+            throw std::runtime_error("cmc: snapshot has too many slots");
+        }
+
+        size_t fileSize = file.size();
+
+        size_t objectsAt = detail::alignSnapshot(sizeof(header));
+        size_t objectSlotsAt = detail::alignSnapshot(detail::endOfSnapshotArray(objectsAt, header.objectCount, sizeof(T), fileSize));
+        size_t slotOffsetsAt = detail::alignSnapshot(detail::endOfSnapshotArray(objectSlotsAt, header.objectCount, sizeof(unsigned int), fileSize));
+        size_t slotGenerationsAt = detail::alignSnapshot(detail::endOfSnapshotArray(slotOffsetsAt, header.slotCount, sizeof(unsigned int), fileSize));
+        size_t freeSlotsAt = detail::alignSnapshot(detail::endOfSnapshotArray(slotGenerationsAt, header.slotCount, sizeof(unsigned int), fileSize));
+        detail::endOfSnapshotArray(freeSlotsAt, header.freeCount, sizeof(unsigned int), fileSize);
+
+        size_t count = static_cast<size_t>(header.objectCount);
+        size_t slotCount = static_cast<size_t>(header.slotCount);
+        size_t freeCount = static_cast<size_t>(header.freeCount);
+
+        const unsigned char* data = file.data();
+        const unsigned int* objectSlots = reinterpret_cast<const unsigned int*>(data + objectSlotsAt);
+        const unsigned int* slotOffsets = reinterpret_cast<const unsigned int*>(data + slotOffsetsAt);
+        const unsigned int* slotGenerations = reinterpret_cast<const unsigned int*>(data + slotGenerationsAt);
+        const unsigned int* freeSlots = reinterpret_cast<const unsigned int*>(data + freeSlotsAt);
+
+        if (!SlotMap::isConsistent(objectSlots, count, slotOffsets, slotCount, freeSlots, freeCount)) {
+            throw std::runtime_error("cmc: snapshot slot tables are inconsistent");
+        }
+
+        checkCapacity(count);
+
+        clear();
+        reserve(count);
+
+        appendRangeTo(objects_, reinterpret_cast<const T*>(data + objectsAt), count);
+        refCount_.assign(count, 1U);
+
+        slots_.assign(objectSlots, count, slotOffsets, slotGenerations, slotCount, freeSlots, freeCount);
+        handleOwned_.assign(slotCount, 0);
+
+        for (size_t i = 0; i < count; ++i) {
+            handleOwned_[objectSlots[i]] = 1;
+        }
+
+        if (trackDirty_) {
+            dirty_.assign((count + 63) / 64, ~static_cast<uint64_t>(0));
+
+            if ((count & 63) != 0) {
+                dirty_.back() = (static_cast<uint64_t>(1) << (count & 63)) - 1;
+            }
+        }
+
+        epoch_++;
+
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onReset();
+        }
+    }
+
+    T* begin() {
+        return objects_.data();
+    }
+
+    T* end() {
+        return objects_.data() + objects_.size();
+    }
+
+    const T* begin() const {
+        return objects_.data();
+    }
+
+    const T* end() const {
+        return objects_.data() + objects_.size();
+    }
+
+    T* data() {
+        return objects_.data();
+    }
+
+    const T* data() const {
+        return objects_.data();
+    }
+
+    size_t size() const {
+        return objects_.size();
+    }
+
+    template<typename F>
+    void forEach(F f) {
+        forEachPageOf(objects_, [&f](T* first, size_t count) {
+            T* last = first + count;
+
+            for (T* it = first; it != last; ++it) {
+                f(*it);
+            }
+        });
+    }
+
+    // Calls f(first, count) for every contiguous run of objects: once for the
+    // default storage, once per page for paged storage.
+    template<typename F>
+    void forEachPage(F f) {
+        forEachPageOf(objects_, f);
+    }
+
+    // Moves the object at position order[i] to position i. Pointers and
+    // handles reference slots, so they keep referencing the same objects.
+    void reorder(const std::vector<unsigned int>& order) {
+        checkPermutation(order);
+        applyOrder(order);
+    }
+
+    template<typename Compare>
+    void sort(Compare comp) {
+        std::vector<unsigned int> order(objects_.size());
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = static_cast<unsigned int>(i);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [this, &comp](unsigned int a, unsigned int b) {
+            return comp(objects_[a], objects_[b]);
+        });
+
+        applyOrder(order);
+    }
+
+    // Places the referenced objects first, in the order of the sequence, and
+    // keeps the relative order of the others after them.
+    void reorderBy(const std::vector<Handle<T>>& handles) {
+        size_t count = objects_.size();
+
+        std::vector<unsigned int> order;
+        std::vector<bool> taken(count, false);
+        order.reserve(count);
+
+        for (Handle<T> handle : handles) {
+            if (isValid(handle)) {
+                unsigned int eleIndex = slots_.getOffset(handle.getIndex());
+
+                if (!taken[eleIndex]) {
+                    taken[eleIndex] = true;
+                    order.emplace_back(eleIndex);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (!taken[i]) {
+                order.emplace_back(static_cast<unsigned int>(i));
+            }
+        }
+
+        applyOrder(order);
+    }
+
+    void reorderBy(const std::vector<Ptr<T>>& ptrs) {
+        reorderBy(handlesOf(ptrs));
+    }
+
+    // Incremental reorderBy(): every reorderStep() moves at most maxMoves
+    // objects and returns true once the referenced objects are in place. The
+    // order of the other objects is not kept, and objects created or destroyed
+    // between two steps may end up out of place.
+    void beginReorder(const std::vector<Handle<T>>& handles) {
+        reorderTarget_ = handles;
+        reorderCursor_ = 0;
+        reorderPos_ = 0;
+    }
+
+    void beginReorder(const std::vector<Ptr<T>>& ptrs) {
+        beginReorder(handlesOf(ptrs));
+    }
+
+    bool reorderStep(size_t maxMoves) {
+        while ((reorderCursor_ < reorderTarget_.size()) && (reorderPos_ < objects_.size())) {
+            Handle<T> handle = reorderTarget_[reorderCursor_];
+
+            if (isValid(handle)) {
+                size_t eleIndex = slots_.getOffset(handle.getIndex());
+
+                if (eleIndex < reorderPos_) {
+                    reorderCursor_++;
+                    continue;
+                }
+
+                if (eleIndex != reorderPos_) {
+                    if (maxMoves == 0) {
+                        return false;
+                    }
+
+                    swapElements(reorderPos_, eleIndex);
+                    maxMoves--;
+                }
+
+                reorderPos_++;
+            }
+
+            reorderCursor_++;
+        }
+
+        reorderTarget_.clear();
+
+        return true;
     }
 
-    const std::vector<Ptr<T>*>& getPtrAddresses() const {
+    // Destroys every group of objects kept alive only by pointers stored in
+    // objects of the same group, as listed by CycleTraits<T>. Returns the
+    // number of destroyed objects.
+    size_t collectCycles() {
+        while (!collectCyclesStep(static_cast<size_t>(-1))) {
+        }
+
+        return cycles_.reclaimed;
+    }
+
+    // Runs the cycle collection for about budget slot visits. Returns true
+    // once a pass has finished, and getReclaimedCount() reports what it
+    // destroyed. The container may change between two steps: the state is
+    // kept per slot, objects created after the pass started are left alone,
+    // and the final step checks the garbage again before destroying it, so a
+    // pass is never restarted. That final step costs time proportional to the
+    // garbage it checks and destroys, whatever the budget.
+    bool collectCyclesStep(size_t budget) {
+        if (cycles_.phase == detail::CycleState::kIdle) {
+            startCycles();
+        }
+
+        size_t count = cycles_.count;
+
+        for (; budget > 0; --budget) {
+            if (cycles_.phase == detail::CycleState::kInit) {
+                if (cycles_.cursor == count) {
+                    cycles_.phase = detail::CycleState::kCount;
+                    cycles_.cursor = 0;
+                    continue;
+                }
+
+                cycles_.internalRefs[cycles_.cursor] = 0U;
+                cycles_.reachable[cycles_.cursor] = false;
+                cycles_.cursor++;
+            } else if (cycles_.phase == detail::CycleState::kCount) {
+                if (cycles_.cursor == count) {
+                    cycles_.phase = detail::CycleState::kRoots;
+                    cycles_.cursor = 0;
+                    continue;
+                }
+
+                forEachInternalPtr(static_cast<unsigned int>(cycles_.cursor++), [this](Ptr<T>& p) {
+                    if (ptrOffset_[p.index_] < cycles_.count) {
+                        cycles_.internalRefs[ptrOffset_[p.index_]]++;
+                    }
+                });
+            } else if (cycles_.phase == detail::CycleState::kRoots) {
+                if (cycles_.cursor == count) {
+                    cycles_.phase = detail::CycleState::kMark;
+                    continue;
+                }
+
+                unsigned int slot = static_cast<unsigned int>(cycles_.cursor++);
+
+                if (!isUsedSlot(slot) || (refCount_[slots_.getOffset(slot)] > cycles_.internalRefs[slot])) {
+                    markReachable(slot);
+                }
+            } else if (cycles_.phase == detail::CycleState::kMark) {
+                if (cycles_.pending.empty()) {
+                    cycles_.phase = detail::CycleState::kSweep;
+                    cycles_.cursor = 0;
+                    continue;
+                }
+
+                markFromPending();
+            } else {
+                if (cycles_.cursor == count) {
+                    reclaimCycles();
+                    return true;
+                }
+
+                unsigned int slot = static_cast<unsigned int>(cycles_.cursor++);
+
+                if (!isUsedSlot(slot)) {
+                    cycles_.reachable[slot] = true;
+                } else if (!cycles_.reachable[slot]) {
+                    cycles_.garbage.emplace_back(slot);
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Changes whenever objects may have moved in memory, which invalidates
+    // raw pointers and Ref<T> borrows.
+    unsigned long long getEpoch() const {
+        return epoch_;
+    }
+
+    size_t getReclaimedCount() const {
+        return cycles_.reclaimed;
+    }
+
+    // Splits the objects into ranges of about grain objects that start on a
+    // cache line and runs them on the pool. f must not create or destroy
+    // objects, nor copy or destroy pointers of this container, until the
+    // pass returns.
+    template<typename F>
+    void parallelForEach(ThreadPool& pool, F f, size_t grain = 4096) {
+        std::vector<std::pair<T*, size_t>> ranges;
+
+        forEachPageOf(objects_, [&ranges, grain](T* first, size_t count) {
+            splitIntoRanges(ranges, first, count, grain);
+        });
+
+        inParallelPass_ = true;
+
+        pool.parallelFor(ranges.size(), [&ranges, &f](size_t i) {
+            T* last = ranges[i].first + ranges[i].second;
+
+            for (T* it = ranges[i].first; it != last; ++it) {
+                f(*it);
+            }
+        });
+
+        inParallelPass_ = false;
+    }
+
+    template<typename F>
+    void forEachWithHandle(F f) {
+        size_t count = objects_.size();
+
+        for (size_t i = 0; i < count; ++i) {
+            unsigned int slot = slots_.getSlot(i);
+            f(Handle<T>(slot, slots_.getGeneration(slot)), objects_[i]);
+        }
+    }
+
+    MemoryResource* getResource() const {
+        return objects_.get_allocator().getResource();
+    }
+
+    size_t getCapacity() const {
+        return capacity_;
+    }
+
+    const Vector<Ptr<T>*>& getPtrAddresses() const {
         return ptrAddress_;
     }
 
-    const std::vector<unsigned int>& getPtrOffsets() const {
+    const Vector<unsigned int>& getPtrOffsets() const {
         return ptrOffset_;
     }
 
-    const std::vector<unsigned int>& getRefCounts() const {
+    const Vector<unsigned int>& getSlotOffsets() const {
+        return slots_.getSlotOffsets();
+    }
+
+    const Vector<unsigned int>& getSlotGenerations() const {
+        return slots_.getSlotGenerations();
+    }
+
+    const Vector<unsigned int>& getObjectSlots() const {
+        return slots_.getObjectSlots();
+    }
+
+    const Vector<unsigned int>& getRefCounts() const {
         return refCount_;
     }
 
-    const std::vector<T>& getObjects() const {
+    const Storage& getObjects() const {
         return objects_;
     }
 
@@ -57,6 +839,9 @@ public:
         for (Ptr<T>* ptr : ptrAddress_) {
             ptr->c_ = nullptr;
         }
+
+        ptrAddress_.clear();
+        ptrOffset_.clear();
     }
 
     const Container<T>& operator=(const Container<T>& obj) = delete;
@@ -64,39 +849,501 @@ public:
     bool operator!=(const Container<T>& obj) = delete;
 
 private:
+    static const size_t kCacheLineBytes = 64;
+
+    static constexpr size_t gcd(size_t a, size_t b) {
+        return (b == 0) ? a : gcd(b, a % b);
+    }
+
+    // Range boundaries are placed where an object starts a cache line, so two
+    // threads never write the same line. Objects whose size does not allow it
+    // are split every grain objects.
+    static void splitIntoRanges(std::vector<std::pair<T*, size_t>>& ranges, T* first, size_t count, size_t grain) {
+        const size_t step = kCacheLineBytes / gcd(kCacheLineBytes, sizeof(T));
+
+        size_t head = 0;
+        while ((head < step) && (head < count) &&
+               ((reinterpret_cast<uintptr_t>(first + head) % kCacheLineBytes) != 0)) {
+            head++;
+        }
+
+        if ((head == step) || (head == count)) {
+            head = 0;
+        }
+
+        size_t chunk = ((grain + step - 1) / step) * step;
+        size_t begin = 0;
+        size_t end = (head != 0) ? head : chunk;
+
+        while (begin < count) {
+            if (end > count) {
+                end = count;
+            }
+
+            ranges.emplace_back(first + begin, end - begin);
+
+            begin = end;
+            end += chunk;
+        }
+    }
+
+    bool isDirtyAt(size_t eleIndex) const {
+        return (dirty_[eleIndex >> 6] >> (eleIndex & 63)) & 1;
+    }
+
+    void setDirty(size_t eleIndex) {
+        dirty_[eleIndex >> 6] |= static_cast<uint64_t>(1) << (eleIndex & 63);
+    }
+
+    void assignDirty(size_t eleIndex, bool dirty) {
+        uint64_t bit = static_cast<uint64_t>(1) << (eleIndex & 63);
+        dirty_[eleIndex >> 6] = dirty ? (dirty_[eleIndex >> 6] | bit) : (dirty_[eleIndex >> 6] & ~bit);
+    }
+
+    static void writeArray(detail::SnapshotWriter& writer, const Vector<unsigned int>& values) {
+        writer.pad();
+        writer.write(values.data(), values.size() * sizeof(unsigned int));
+    }
+
+    void checkPermutation(const std::vector<unsigned int>& order) const {
+        size_t count = objects_.size();
+
+        if (order.size() != count) {
+            throw std::invalid_argument("cmc::Container order must have one entry per object");
+        }
+
+        std::vector<bool> seen(count, false);
+
+        for (unsigned int eleIndex : order) {
+            if ((eleIndex >= count) || seen[eleIndex]) {
+                throw std::invalid_argument("cmc::Container order is not a permutation");
+            }
+
+            seen[eleIndex] = true;
+        }
+    }
+
+    void applyOrder(const std::vector<unsigned int>& order) {
+        checkStructuralChange();
+        epoch_++;
+
+        std::vector<bool> placed;
+
+        detail::permute(objects_, order, placed);
+        detail::permute(refCount_, order, placed);
+        slots_.permute(order, placed);
+
+        // The old bits are copied to the global heap, like the other
+        // temporaries, and dirty_ is rewritten in place.
+        if (trackDirty_) {
+            std::vector<uint64_t> dirty(dirty_.begin(), dirty_.end());
+            std::fill(dirty_.begin(), dirty_.end(), 0);
+
+            for (size_t i = 0; i < order.size(); ++i) {
+                if ((dirty[order[i] >> 6] >> (order[i] & 63)) & 1) {
+                    setDirty(i);
+                }
+            }
+        }
+
+        if (!observers_.empty()) {
+            notifyOrder(order, placed);
+        }
+    }
+
+    // Reports a permutation as the swaps that apply it: swapping every
+    // position of a cycle with the next one moves the whole cycle.
+    void notifyOrder(const std::vector<unsigned int>& order, std::vector<bool>& placed) {
+        placed.assign(order.size(), false);
+
+        for (size_t i = 0; i < order.size(); ++i) {
+            for (size_t j = i; !placed[j]; j = order[j]) {
+                placed[j] = true;
+
+                if (!placed[order[j]]) {
+                    for (ContainerObserver<T>* observer : observers_) {
+                        observer->onSwap(j, order[j]);
+                    }
+                }
+            }
+        }
+    }
+
+    void notifyWrite(unsigned int slot) {
+        const T& obj = objects_[slots_.getOffset(slot)];
+
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onWrite(slot, slots_.getGeneration(slot), obj);
+        }
+    }
+
+    void swapElements(size_t a, size_t b) {
+        checkStructuralChange();
+        epoch_++;
+
+        std::swap(objects_[a], objects_[b]);
+        std::swap(refCount_[a], refCount_[b]);
+        slots_.swapElements(a, b);
+
+        if (trackDirty_) {
+            bool dirtyA = isDirtyAt(a);
+            assignDirty(a, isDirtyAt(b));
+            assignDirty(b, dirtyA);
+        }
+
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onSwap(a, b);
+        }
+    }
+
+    std::vector<Handle<T>> handlesOf(const std::vector<Ptr<T>>& ptrs) const {
+        std::vector<Handle<T>> handles;
+        handles.reserve(ptrs.size());
+
+        for (const Ptr<T>& ptr : ptrs) {
+            if (ptr.c_ == this) {
+                handles.emplace_back(handleOf(ptr));
+            }
+        }
+
+        return handles;
+    }
+
+    Handle<T> handleOf(const Ptr<T>& ptr) const {
+        unsigned int slot = ptrOffset_[ptr.index_];
+        return Handle<T>(slot, slots_.getGeneration(slot));
+    }
+
+    // Counts the references every object receives from pointers stored in
+    // other objects of this container. Objects referenced from anywhere else
+    // are the roots, and whatever they cannot reach is garbage. The slots
+    // that exist when the pass starts are visited, since slots keep
+    // referencing the same objects when the array is compacted or reordered.
+    // Growing the arrays is amortized over the slots created since the last
+    // pass, and clearing them is done by the steps.
+    void startCycles() {
+        size_t count = slots_.getSlotOffsets().size();
+
+        if (cycles_.internalRefs.size() < count) {
+            cycles_.internalRefs.resize(count);
+            cycles_.reachable.resize(count);
+        }
+
+        cycles_.phase = detail::CycleState::kInit;
+        cycles_.cursor = 0;
+        cycles_.count = count;
+        cycles_.pending.clear();
+        cycles_.garbage.clear();
+    }
+
+    template<typename F>
+    void forEachInternalPtr(unsigned int slot, F f) {
+        if (!isUsedSlot(slot)) {
+            return;
+        }
+
+        CycleTraits<T>::forEachPtr(objects_[slots_.getOffset(slot)], [this, &f](Ptr<T>& p) {
+            if (p.c_ == this) {
+                f(p);
+            }
+        });
+    }
+
+    // Free slots are marked too, so the objects that reuse them later in the
+    // pass are never taken for garbage.
+    void markReachable(unsigned int slot) {
+        if ((slot < cycles_.count) && !cycles_.reachable[slot]) {
+            cycles_.reachable[slot] = true;
+            cycles_.pending.emplace_back(slot);
+        }
+    }
+
+    void markFromPending() {
+        unsigned int slot = cycles_.pending.back();
+        cycles_.pending.pop_back();
+
+        forEachInternalPtr(slot, [this](Ptr<T>& p) {
+            markReachable(ptrOffset_[p.index_]);
+        });
+    }
+
+    bool isCycleGarbage(unsigned int slot) const {
+        return (slot < cycles_.count) && !cycles_.reachable[slot];
+    }
+
+    // Pointers may have been copied, moved or released since they were
+    // counted, so the garbage is checked again: an object referenced by more
+    // than the pointers stored in the garbage is alive, and so is everything
+    // it reaches. What remains is referenced from nowhere else. Pointers
+    // between garbage objects are detached first, so destroying the garbage
+    // only releases the objects that stay alive.
+    void reclaimCycles() {
+        std::vector<unsigned int>& garbage = cycles_.garbage;
+
+        for (unsigned int slot : garbage) {
+            cycles_.internalRefs[slot] = 0U;
+        }
+
+        for (unsigned int slot : garbage) {
+            forEachInternalPtr(slot, [this](Ptr<T>& p) {
+                if (isCycleGarbage(ptrOffset_[p.index_])) {
+                    cycles_.internalRefs[ptrOffset_[p.index_]]++;
+                }
+            });
+        }
+
+        for (unsigned int slot : garbage) {
+            if (refCount_[slots_.getOffset(slot)] > cycles_.internalRefs[slot]) {
+                markReachable(slot);
+            }
+        }
+
+        while (!cycles_.pending.empty()) {
+            markFromPending();
+        }
+
+        garbage.erase(std::remove_if(garbage.begin(), garbage.end(), [this](unsigned int slot) {
+            return !isCycleGarbage(slot);
+        }), garbage.end());
+
+        for (unsigned int slot : garbage) {
+            forEachInternalPtr(slot, [this](Ptr<T>& p) {
+                if (isCycleGarbage(ptrOffset_[p.index_])) {
+                    clearPointer(p.index_);
+                    p.c_ = nullptr;
+                }
+            });
+        }
+
+        for (unsigned int slot : garbage) {
+            eraseElement(slot);
+        }
+
+        cycles_.phase = detail::CycleState::kIdle;
+        cycles_.reclaimed = garbage.size();
+    }
+
+    void checkStructuralChange() const {
+        assert(!inParallelPass_ && "cmc::Container changed during parallelForEach()");
+    }
+
+    // Pointers register themselves in shared arrays, so worker threads must
+    // not copy, move or release them.
+    void checkPtrChange() const {
+        assert(!inParallelPass_ && "cmc::Ptr copied or released during parallelForEach()");
+    }
+
+    // A handle owns a reference only when it was returned at creation, so a
+    // handle found through an index or an iteration cannot account for the
+    // Ptr that owns the object.
+    void checkSoleOwner(Handle<T> handle, const char* message) const {
+        unsigned int slot = handle.getIndex();
+
+        if (refCount_[slots_.getOffset(slot)] > static_cast<unsigned int>(handleOwned_[slot])) {
+            throw std::logic_error(message);
+        }
+    }
+
+    void checkCapacity(size_t count) const {
+        if ((capacity_ != 0) && (count > capacity_)) {
+            throw std::length_error("cmc::Container capacity exceeded");
+        }
+    }
+
+    void checkPtrCapacity(size_t count) const {
+        if ((ptrCapacity_ != 0) && (ptrAddress_.size() + count > ptrCapacity_)) {
+            throw std::length_error("cmc::Container pointer capacity exceeded");
+        }
+    }
+
+    template<typename... Args>
+    unsigned int emplaceObject(unsigned int refCount, Args&&... args) {
+        checkStructuralChange();
+        checkCapacity(objects_.size() + 1);
+
+        epoch_++;
+
+        objects_.emplace_back(std::forward<Args>(args)...);
+        refCount_.emplace_back(refCount);
+
+        unsigned int index = static_cast<unsigned int>(objects_.size() - 1);
+        unsigned int slot = slots_.acquire(index);
+
+        if (slot == handleOwned_.size()) {
+            handleOwned_.emplace_back(0);
+        } else {
+            handleOwned_[slot] = 0;
+        }
+
+        if (trackDirty_) {
+            if ((index >> 6) == dirty_.size()) {
+                dirty_.emplace_back(0);
+            }
+
+            setDirty(index);
+        }
+
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onCreate(slot, slots_.getGeneration(slot), objects_[index]);
+        }
+
+        return slot;
+    }
+
+    Ptr<T> ptrTo(unsigned int slot) {
+        ptrOffset_.emplace_back(slot);
+
+        Ptr<T> ptr(this, ptrOffset_.size() - 1);
+
+        ptrAddress_.emplace_back(&ptr);
+
+        return ptr;
+    }
+
+    void reserveFor(std::vector<Ptr<T>>& out, size_t count) {
+        checkPtrCapacity(count);
+        reserve(objects_.size() + count);
+
+        ptrAddress_.reserve(ptrAddress_.size() + count);
+        ptrOffset_.reserve(ptrOffset_.size() + count);
+
+        out.reserve(out.size() + count);
+    }
+
+    // The output vector must not grow while pointers are appended, so every
+    // registered address stays valid.
+    void appendPtr(std::vector<Ptr<T>>& out, unsigned int slot) {
+        ptrOffset_.emplace_back(slot);
+        out.emplace_back(this, static_cast<unsigned int>(ptrOffset_.size() - 1));
+        ptrAddress_.emplace_back(&(out.back()));
+    }
+
+    unsigned int getElementIndex(unsigned int ptrOffset) const {
+        return slots_.getOffset(ptrOffset_[ptrOffset]);
+    }
+
     void incRefOf(unsigned int ptrOffset) {
-        unsigned int eleIndex = ptrOffset_[ptrOffset];
+        unsigned int eleIndex = getElementIndex(ptrOffset);
         refCount_[eleIndex]++;
     }
 
     void decRefOf(unsigned int ptrOffset) {
-        unsigned int eleIndex = ptrOffset_[ptrOffset];
+        unsigned int eleIndex = getElementIndex(ptrOffset);
         refCount_[eleIndex]--;
     }
 
     unsigned int getRefCount(unsigned int ptrOffset) const {
-        unsigned int eleIndex = ptrOffset_[ptrOffset];
+        unsigned int eleIndex = getElementIndex(ptrOffset);
         return refCount_[eleIndex];
     }
 
+    void retainSlot(unsigned int slot) {
+        refCount_[slots_.getOffset(slot)]++;
+    }
+
+    bool isUsedSlot(unsigned int slot) const {
+        return  (slot < slots_.getSlotOffsets().size()) &&
+                (slots_.getOffset(slot) < objects_.size()) &&
+                (slots_.getSlot(slots_.getOffset(slot)) == slot);
+    }
+
+    void releaseSlot(unsigned int slot) {
+        unsigned int eleIndex = slots_.getOffset(slot);
+
+        if (--refCount_[eleIndex] == 0) {
+            if (deferDestruction_) {
+                pending_.emplace_back(slot);
+            } else {
+                eraseElement(slot);
+            }
+        }
+    }
+
     void clearContainedElement(unsigned int ptrOffset) {
+        eraseElement(ptrOffset_[ptrOffset]);
+    }
+
+    // Removed objects are moved out and destroyed only once the container is
+    // consistent again, since their destructors may release pointers to
+    // objects stored here.
+    void eraseElement(unsigned int remSlot) {
+        eraseElement(slots_.getOffset(remSlot), std::is_trivially_copyable<T>());
+    }
+
+    void eraseElement(size_t remElem, std::true_type) {
+        compactInto(remElem);
+    }
+
+    void eraseElement(size_t remElem, std::false_type) {
+        T removed(std::move(objects_[remElem]));
+        compactInto(remElem);
+    }
+
+    // Scanning backwards guarantees that the last object is never marked, so
+    // every marked object is removed with a single swap-and-pop.
+    void eraseElements(const std::vector<bool>& deadElems) {
+        std::vector<T> removed;
+
+        for (size_t i = deadElems.size(); i-- > 0;) {
+            if (deadElems[i]) {
+                moveOut(removed, i, std::is_trivially_copyable<T>());
+                compactInto(i);
+            }
+        }
+    }
+
+    void moveOut(std::vector<T>&, size_t, std::true_type) {
+    }
+
+    void moveOut(std::vector<T>& removed, size_t remElem, std::false_type) {
+        removed.emplace_back(std::move(objects_[remElem]));
+    }
+
+    void compactInto(size_t remElem) {
+        checkStructuralChange();
+        epoch_++;
+
         size_t lastElem = objects_.size() - 1;
-        size_t remElem = ptrOffset_[ptrOffset];
+        unsigned int remSlot = slots_.getSlot(remElem);
 
         if (remElem != lastElem) {
-            objects_[remElem] = objects_[lastElem];
+            relocate(objects_[remElem], objects_[lastElem], std::is_trivially_copyable<T>());
             refCount_[remElem] = refCount_[lastElem];
+        }
 
-            size_t count = ptrOffset_.size();
-            for (size_t i = 0; i < count; ++i) {
-                if (ptrOffset_[i] == lastElem) {
-                    ptrOffset_[i] = remElem;
-                }
-            }
+        if (trackDirty_) {
+            assignDirty(remElem, isDirtyAt(lastElem));
+            assignDirty(lastElem, false);
         }
 
         objects_.pop_back();
         refCount_.pop_back();
+
+        unsigned int remGeneration = slots_.getGeneration(remSlot);
+        slots_.erase(remSlot);
+        handleOwned_[remSlot] = 0;
+
+        if (!observers_.empty()) {
+            notifyErase(remSlot, remGeneration, remElem, lastElem);
+        }
+    }
+
+    void notifyErase(unsigned int remSlot, unsigned int remGeneration, size_t remElem, size_t lastElem) {
+        for (ContainerObserver<T>* observer : observers_) {
+            observer->onDestroy(remSlot, remGeneration);
+
+            if (remElem != lastElem) {
+                observer->onMove(slots_.getSlot(remElem), lastElem, remElem);
+            }
+        }
+    }
+
+    static void relocate(T& dst, T& src, std::true_type) {
+        std::memcpy(static_cast<void*>(&dst), &src, sizeof(T));
+    }
+
+    static void relocate(T& dst, T& src, std::false_type) {
+        dst = std::move(src);
     }
 
     void clearPointer(unsigned int ptrOffset) {
@@ -115,10 +1362,25 @@ private:
     }
 
 
-    std::vector<Ptr<T>*> ptrAddress_;
-    std::vector<unsigned int> ptrOffset_;
-    std::vector<unsigned int> refCount_;
-    std::vector<T> objects_;
+    Vector<Ptr<T>*> ptrAddress_;
+    Vector<unsigned int> ptrOffset_;
+    SlotMap slots_;
+    Vector<unsigned int> refCount_;
+    Storage objects_;
+    Vector<uint64_t> dirty_;
+    Vector<unsigned int> pending_;
+    Vector<unsigned char> handleOwned_;
+    size_t capacity_ = 0;
+    size_t ptrCapacity_ = 0;
+    bool inParallelPass_ = false;
+    bool trackDirty_ = false;
+    bool deferDestruction_ = false;
+    unsigned long long epoch_ = 0;
+    detail::CycleState cycles_;
+    std::vector<Handle<T>> reorderTarget_;
+    std::vector<ContainerObserver<T>*> observers_;
+    size_t reorderCursor_ = 0;
+    size_t reorderPos_ = 0;
 };
 
 }
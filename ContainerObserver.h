@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+namespace cmc {
+
+// Receives every change of a Container<T> right after it happens. Objects are
+// identified by slot and generation, like handles; positions are indices in
+// the packed object array.
+template<class T>
+class ContainerObserver {
+public:
+    virtual ~ContainerObserver() = default;
+
+    virtual void onCreate(unsigned int slot, unsigned int generation, const T& obj) = 0;
+
+    // The object is already gone when this is called.
+    virtual void onDestroy(unsigned int slot, unsigned int generation) = 0;
+
+    // The object of slot moved from one position to another, e.g. to fill the
+    // hole left by a destroyed object.
+    virtual void onMove(unsigned int slot, size_t from, size_t to) = 0;
+
+    // The objects at positions a and b swapped places, as done by reordering.
+    virtual void onSwap(size_t a, size_t b) = 0;
+
+    virtual void onWrite(unsigned int slot, unsigned int generation, const T& obj) = 0;
+
+    // Every object was destroyed at once, as done by clear().
+    virtual void onClear() = 0;
+
+    // The whole content was replaced without individual events, as done by
+    // load().
+    virtual void onReset() = 0;
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace cmc {
+
+// Lists the pointers stored inside an object so the cycle collector can
+// follow them. Types without pointers to their own type can keep the default,
+// which reports none. Specialize it for the others, e.g.
+//
+//     template<typename F>
+//     static void forEachPtr(Node& obj, F f) {
+//         for (Ptr<Node>& p : obj.children) {
+//             f(p);
+//         }
+//     }
+template<class T>
+struct CycleTraits {
+    template<typename F>
+    static void forEachPtr(T&, F) {}
+};
+
+namespace detail {
+
+// Progress of an incremental cycle collection, kept between two steps and
+// indexed by slot. Every phase but kMark visits the slots in order.
+struct CycleState {
+    enum Phase {
+        kIdle,
+        kInit,
+        kCount,
+        kRoots,
+        kMark,
+        kSweep
+    };
+
+    Phase phase = kIdle;
+    size_t cursor = 0;
+    size_t count = 0;
+    size_t reclaimed = 0;
+    std::vector<unsigned int> internalRefs;
+    std::vector<bool> reachable;
+    std::vector<unsigned int> pending;
+    std::vector<unsigned int> garbage;
+};
+}
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+namespace cmc {
+
+template<class T>
+class Handle final {
+public:
+    static const unsigned int kInvalidIndex = ~0U;
+
+    Handle()
+    : index_(kInvalidIndex)
+    , generation_(0U)
+    {}
+
+    explicit Handle(unsigned int index, unsigned int generation)
+    : index_(index)
+    , generation_(generation)
+    {}
+
+    template<typename A> Handle(A) = delete;
+
+    unsigned int getIndex() const {
+        return index_;
+    }
+
+    unsigned int getGeneration() const {
+        return generation_;
+    }
+
+    bool operator==(const Handle<T>& obj) const {
+        return (index_ == obj.index_) && (generation_ == obj.generation_);
+    }
+
+    bool operator!=(const Handle<T>& obj) const {
+        return !((*this) == obj);
+    }
+
+private:
+    unsigned int index_;
+    unsigned int generation_;
+};
+
+template<class T> const unsigned int Handle<T>::kInvalidIndex;
+
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+#include "Container.h"
+#include "ContainerObserver.h"
+#include "Handle.h"
+#include "Ptr.h"
+#include "WeakPtr.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace cmc {
+
+namespace detail {
+
+// Key of every indexed slot, so an entry can be found again once its object
+// is already destroyed.
+template<class Key>
+class SlotKeys final {
+public:
+    bool has(unsigned int slot) const {
+        return (slot < indexed_.size()) && indexed_[slot];
+    }
+
+    const Key& get(unsigned int slot) const {
+        return keys_[slot];
+    }
+
+    void set(unsigned int slot, const Key& key) {
+        if (slot >= keys_.size()) {
+            keys_.resize(slot + 1);
+            indexed_.resize(slot + 1, false);
+        }
+
+        keys_[slot] = key;
+        indexed_[slot] = true;
+    }
+
+    void reset(unsigned int slot) {
+        indexed_[slot] = false;
+    }
+
+    void clear() {
+        keys_.clear();
+        indexed_.clear();
+    }
+
+private:
+    std::vector<Key> keys_;
+    std::vector<bool> indexed_;
+};
+
+}
+
+// Open-addressing hash index from the key of each object, as returned by
+// keyOf(obj), to its slot. It observes the container, so it follows creations
+// and destructions; slots never move, so compaction and reordering cost
+// nothing. A key that changes after creation must be reported with
+// Container::markWritten(). Several objects may share a key, in which case
+// lookups return one of them.
+template<class T, class Key, class KeyOf, class Hash = std::hash<Key>>
+class HashIndex final : public ContainerObserver<T> {
+public:
+    explicit HashIndex(Container<T>& c, KeyOf keyOf = KeyOf(), Hash hash = Hash())
+    : c_(c)
+    , keyOf_(keyOf)
+    , hash_(hash)
+    , table_(kMinBuckets, kEmpty)
+    , used_(0)
+    , size_(0)
+    {
+        rebuild();
+        c_.addObserver(this);
+    }
+
+    HashIndex(const HashIndex& obj) = delete;
+    const HashIndex& operator=(const HashIndex& obj) = delete;
+
+    ~HashIndex() {
+        c_.removeObserver(this);
+    }
+
+    // Returns an invalid handle when no object has the key.
+    Handle<T> find(const Key& key) const {
+        unsigned int slot = findSlot(key);
+
+        if (slot == kEmpty) {
+            return Handle<T>();
+        }
+
+        return Handle<T>(slot, c_.getSlotGenerations()[slot]);
+    }
+
+    // Throws std::out_of_range when no object has the key.
+    Ptr<T> at(const Key& key) const {
+        unsigned int slot = findSlot(key);
+
+        if (slot == kEmpty) {
+            throw std::out_of_range("cmc::HashIndex has no object with this key");
+        }
+
+        return WeakPtr<T>(&c_, Handle<T>(slot, c_.getSlotGenerations()[slot])).lock();
+    }
+
+    bool contains(const Key& key) const {
+        return findSlot(key) != kEmpty;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Longest distance between an entry and its home bucket, i.e. the extra
+    // probes the worst lookup needs.
+    size_t getMaxProbeLength() const {
+        size_t mask = table_.size() - 1;
+        size_t longest = 0;
+
+        for (size_t i = 0; i < table_.size(); ++i) {
+            if ((table_[i] != kEmpty) && (table_[i] != kErased)) {
+                longest = std::max(longest, (i - bucketOf(keys_.get(table_[i]))) & mask);
+            }
+        }
+
+        return longest;
+    }
+
+    void onCreate(unsigned int slot, unsigned int, const T& obj) override {
+        insert(slot, keyOf_(obj));
+    }
+
+    void onDestroy(unsigned int slot, unsigned int) override {
+        erase(slot);
+    }
+
+    void onMove(unsigned int, size_t, size_t) override {
+    }
+
+    void onSwap(size_t, size_t) override {
+    }
+
+    void onWrite(unsigned int slot, unsigned int, const T& obj) override {
+        erase(slot);
+        insert(slot, keyOf_(obj));
+    }
+
+    void onClear() override {
+        table_.assign(kMinBuckets, kEmpty);
+        keys_.clear();
+        used_ = 0;
+        size_ = 0;
+    }
+
+    void onReset() override {
+        onClear();
+        rebuild();
+    }
+
+private:
+    static const unsigned int kEmpty = ~0U;
+    static const unsigned int kErased = ~0U - 1;
+    static const size_t kMinBuckets = 16;
+
+    // std::hash is the identity for integers in common standard libraries,
+    // so masking it would put keys sharing their low bits in one bucket.
+    // Fibonacci hashing keeps the top bits of the product instead, which
+    // depend on every bit of the hash.
+    size_t bucketOf(const Key& key) const {
+        uint64_t mixed = static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(mixed >> (64 - __builtin_ctzll(table_.size())));
+    }
+
+    unsigned int findSlot(const Key& key) const {
+        size_t mask = table_.size() - 1;
+
+        for (size_t i = bucketOf(key); table_[i] != kEmpty; i = (i + 1) & mask) {
+            if ((table_[i] != kErased) && (keys_.get(table_[i]) == key)) {
+                return table_[i];
+            }
+        }
+
+        return kEmpty;
+    }
+
+    // Erased buckets count as used, so probing always ends on an empty one.
+    void insert(unsigned int slot, const Key& key) {
+        if ((used_ + 1) * 2 > table_.size()) {
+            rehash();
+        }
+
+        keys_.set(slot, key);
+
+        size_t mask = table_.size() - 1;
+        size_t i = bucketOf(key);
+
+        while ((table_[i] != kEmpty) && (table_[i] != kErased)) {
+            i = (i + 1) & mask;
+        }
+
+        if (table_[i] == kEmpty) {
+            used_++;
+        }
+
+        table_[i] = slot;
+        size_++;
+    }
+
+    void erase(unsigned int slot) {
+        if (!keys_.has(slot)) {
+            return;
+        }
+
+        size_t mask = table_.size() - 1;
+
+        for (size_t i = bucketOf(keys_.get(slot)); table_[i] != kEmpty; i = (i + 1) & mask) {
+            if (table_[i] == slot) {
+                table_[i] = kErased;
+                size_--;
+                break;
+            }
+        }
+
+        keys_.reset(slot);
+    }
+
+    // Grows the table only when live entries fill it, otherwise rehashing in
+    // place drops the erased buckets.
+    void rehash() {
+        size_t buckets = table_.size();
+        while ((size_ + 1) * 4 > buckets) {
+            buckets *= 2;
+        }
+
+        std::vector<unsigned int> old(buckets, kEmpty);
+        old.swap(table_);
+
+        size_t mask = buckets - 1;
+
+        for (unsigned int slot : old) {
+            if ((slot == kEmpty) || (slot == kErased)) {
+                continue;
+            }
+
+            size_t i = bucketOf(keys_.get(slot));
+            while (table_[i] != kEmpty) {
+                i = (i + 1) & mask;
+            }
+
+            table_[i] = slot;
+        }
+
+        used_ = size_;
+    }
+
+    void rebuild() {
+        const typename Container<T>::Storage& objects = c_.getObjects();
+        const Vector<unsigned int>& slots = c_.getObjectSlots();
+
+        for (size_t i = 0; i < objects.size(); ++i) {
+            insert(slots[i], keyOf_(objects[i]));
+        }
+    }
+
+    Container<T>& c_;
+    KeyOf keyOf_;
+    Hash hash_;
+    std::vector<unsigned int> table_;
+    detail::SlotKeys<Key> keys_;
+    size_t used_;
+    size_t size_;
+};
+
+template<class T, class Key, class KeyOf, class Hash> const unsigned int HashIndex<T, Key, KeyOf, Hash>::kEmpty;
+template<class T, class Key, class KeyOf, class Hash> const unsigned int HashIndex<T, Key, KeyOf, Hash>::kErased;
+template<class T, class Key, class KeyOf, class Hash> const size_t HashIndex<T, Key, KeyOf, Hash>::kMinBuckets;
+
+// Sorted array of (key, slot) entries, for lookups and ordered range scans in
+// O(log n). Kept up to date like HashIndex; inserting and erasing shift the
+// entries after the position, so it suits keys read far more than written.
+template<class T, class Key, class KeyOf, class Compare = std::less<Key>>
+class SortedIndex final : public ContainerObserver<T> {
+public:
+    explicit SortedIndex(Container<T>& c, KeyOf keyOf = KeyOf(), Compare comp = Compare())
+    : c_(c)
+    , keyOf_(keyOf)
+    , comp_(comp)
+    {
+        rebuild();
+        c_.addObserver(this);
+    }
+
+    SortedIndex(const SortedIndex& obj) = delete;
+    const SortedIndex& operator=(const SortedIndex& obj) = delete;
+
+    ~SortedIndex() {
+        c_.removeObserver(this);
+    }
+
+    // Returns an invalid handle when no object has the key.
+    Handle<T> find(const Key& key) const {
+        typename std::vector<Entry>::const_iterator it = lowerBound(key);
+
+        if ((it == entries_.end()) || comp_(key, it->key)) {
+            return Handle<T>();
+        }
+
+        return handleAt(*it);
+    }
+
+    // Throws std::out_of_range when no object has the key.
+    Ptr<T> at(const Key& key) const {
+        Handle<T> handle = find(key);
+
+        if (handle.getIndex() == Handle<T>::kInvalidIndex) {
+            throw std::out_of_range("cmc::SortedIndex has no object with this key");
+        }
+
+        return WeakPtr<T>(&c_, handle).lock();
+    }
+
+    bool contains(const Key& key) const {
+        return find(key).getIndex() != Handle<T>::kInvalidIndex;
+    }
+
+    // Calls f(handle) for every object with a key in [first, last), in key
+    // order. f must not create or destroy objects of the container.
+    template<typename F>
+    void forEachInRange(const Key& first, const Key& last, F f) const {
+        for (typename std::vector<Entry>::const_iterator it = lowerBound(first); it != entries_.end(); ++it) {
+            if (!comp_(it->key, last)) {
+                break;
+            }
+
+            f(handleAt(*it));
+        }
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    void onCreate(unsigned int slot, unsigned int, const T& obj) override {
+        insert(slot, keyOf_(obj));
+    }
+
+    void onDestroy(unsigned int slot, unsigned int) override {
+        erase(slot);
+    }
+
+    void onMove(unsigned int, size_t, size_t) override {
+    }
+
+    void onSwap(size_t, size_t) override {
+    }
+
+    void onWrite(unsigned int slot, unsigned int, const T& obj) override {
+        erase(slot);
+        insert(slot, keyOf_(obj));
+    }
+
+    void onClear() override {
+        entries_.clear();
+        keys_.clear();
+    }
+
+    void onReset() override {
+        onClear();
+        rebuild();
+    }
+
+private:
+    struct Entry {
+        Key key;
+        unsigned int slot;
+    };
+
+    typename std::vector<Entry>::const_iterator lowerBound(const Key& key) const {
+        const Compare& comp = comp_;
+
+        return std::lower_bound(entries_.begin(), entries_.end(), key, [&comp](const Entry& entry, const Key& k) {
+            return comp(entry.key, k);
+        });
+    }
+
+    Handle<T> handleAt(const Entry& entry) const {
+        return Handle<T>(entry.slot, c_.getSlotGenerations()[entry.slot]);
+    }
+
+    void insert(unsigned int slot, const Key& key) {
+        keys_.set(slot, key);
+
+        const Compare& comp = comp_;
+        typename std::vector<Entry>::iterator it = std::upper_bound(entries_.begin(), entries_.end(), key, [&comp](const Key& k, const Entry& entry) {
+            return comp(k, entry.key);
+        });
+
+        Entry entry = {key, slot};
+        entries_.insert(it, entry);
+    }
+
+    void erase(unsigned int slot) {
+        if (!keys_.has(slot)) {
+            return;
+        }
+
+        const Key& key = keys_.get(slot);
+        typename std::vector<Entry>::const_iterator it = lowerBound(key);
+
+        // Only entries with the same key are searched, so an entry whose key
+        // changed without markWritten() is not found instead of overrunning.
+        while ((it != entries_.end()) && !comp_(key, it->key) && (it->slot != slot)) {
+            ++it;
+        }
+
+        if ((it != entries_.end()) && (it->slot == slot)) {
+            entries_.erase(entries_.begin() + (it - entries_.begin()));
+        }
+
+        keys_.reset(slot);
+    }
+
+    void rebuild() {
+        const typename Container<T>::Storage& objects = c_.getObjects();
+        const Vector<unsigned int>& slots = c_.getObjectSlots();
+
+        entries_.reserve(objects.size());
+
+        for (size_t i = 0; i < objects.size(); ++i) {
+            Key key = keyOf_(objects[i]);
+            keys_.set(slots[i], key);
+
+            Entry entry = {key, slots[i]};
+            entries_.push_back(entry);
+        }
+
+        const Compare& comp = comp_;
+        std::stable_sort(entries_.begin(), entries_.end(), [&comp](const Entry& a, const Entry& b) {
+            return comp(a.key, b.key);
+        });
+    }
+
+    Container<T>& c_;
+    KeyOf keyOf_;
+    Compare comp_;
+    std::vector<Entry> entries_;
+    detail::SlotKeys<Key> keys_;
+};
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "Container.h"
+#include "ContainerObserver.h"
+#include "Handle.h"
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace cmc {
+
+// Records the changes of a container in a fixed-size ring buffer, so they can
+// be replayed into a replica. Creations and writes keep a copy of the object.
+//
+// Slot allocation and swap-and-pop are deterministic, so a replica that
+// started as an identical copy and applies the same creations, destructions
+// and swaps in the same order ends up with the same slots and layout. Moves
+// done by compaction follow from the destructions and are recorded for other
+// consumers only.
+//
+// When the buffer is full, or the container is replaced by load(), events
+// are dropped and hasOverflowed() becomes true: the replica then needs a full
+// copy, after which discard() resumes the journal.
+template<class T>
+class Journal final : public ContainerObserver<T> {
+public:
+    enum Kind {
+        kCreate,
+        kDestroy,
+        kMove,
+        kSwap,
+        kWrite,
+        kClear
+    };
+
+    struct Event {
+        Kind kind;
+        unsigned int slot;
+        unsigned int generation;
+        unsigned int from;
+        unsigned int to;
+    };
+
+    explicit Journal(size_t capacity)
+    : events_(capacity)
+    , values_(capacity)
+    , head_(0)
+    , size_(0)
+    , overflowed_(false)
+    {}
+
+    Journal(const Journal<T>& obj) = delete;
+    const Journal<T>& operator=(const Journal<T>& obj) = delete;
+
+    ~Journal() {
+        discard();
+    }
+
+    void onCreate(unsigned int slot, unsigned int generation, const T& obj) override {
+        push(kCreate, slot, generation, 0, 0, &obj);
+    }
+
+    void onDestroy(unsigned int slot, unsigned int generation) override {
+        push(kDestroy, slot, generation, 0, 0, nullptr);
+    }
+
+    void onMove(unsigned int slot, size_t from, size_t to) override {
+        push(kMove, slot, 0, from, to, nullptr);
+    }
+
+    void onSwap(size_t a, size_t b) override {
+        push(kSwap, 0, 0, a, b, nullptr);
+    }
+
+    void onWrite(unsigned int slot, unsigned int generation, const T& obj) override {
+        push(kWrite, slot, generation, 0, 0, &obj);
+    }
+
+    void onClear() override {
+        push(kClear, 0, 0, 0, 0, nullptr);
+    }
+
+    void onReset() override {
+        overflowed_ = true;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    size_t capacity() const {
+        return events_.size();
+    }
+
+    bool hasOverflowed() const {
+        return overflowed_;
+    }
+
+    // Calls f(event, value) for every recorded event, oldest first, and
+    // empties the journal. value is the recorded object for creations and
+    // writes, and null otherwise.
+    template<typename F>
+    void consume(F f) {
+        while (size_ > 0) {
+            Event& event = events_[head_];
+            T* value = hasValue(event) ? valueAt(head_) : nullptr;
+
+            f(static_cast<const Event&>(event), static_cast<const T*>(value));
+
+            pop();
+        }
+    }
+
+    // Applies every recorded event to replica.
+    void replayInto(Container<T>& replica) {
+        consume([&replica](const Event& event, const T* value) {
+            Handle<T> handle(event.slot, event.generation);
+
+            switch (event.kind) {
+            case kCreate: {
+                Handle<T> created = replica.makeHandle(*value);
+                assert(created == handle && "cmc::Journal replica has diverged");
+                (void)created;
+                break;
+            }
+            case kDestroy:
+                replica.destroy(handle);
+                break;
+            case kMove:
+                break;
+            case kSwap:
+                replica.swapElements(event.from, event.to);
+                break;
+            case kWrite:
+                if (replica.isValid(handle)) {
+                    *(replica.get(handle)) = *value;
+                }
+                break;
+            case kClear:
+                replica.clear();
+                break;
+            }
+        });
+    }
+
+    // Drops every recorded event and clears the overflow.
+    void discard() {
+        while (size_ > 0) {
+            pop();
+        }
+
+        overflowed_ = false;
+    }
+
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+
+    static bool hasValue(const Event& event) {
+        return (event.kind == kCreate) || (event.kind == kWrite);
+    }
+
+    T* valueAt(size_t i) {
+        return reinterpret_cast<T*>(&values_[i]);
+    }
+
+    void push(Kind kind, unsigned int slot, unsigned int generation, size_t from, size_t to, const T* value) {
+        if (overflowed_ || (size_ == events_.size())) {
+            overflowed_ = true;
+            return;
+        }
+
+        size_t tail = (head_ + size_) % events_.size();
+
+        Event& event = events_[tail];
+        event.kind = kind;
+        event.slot = slot;
+        event.generation = generation;
+        event.from = static_cast<unsigned int>(from);
+        event.to = static_cast<unsigned int>(to);
+
+        if (value != nullptr) {
+            ::new (static_cast<void*>(&values_[tail])) T(*value);
+        }
+
+        size_++;
+    }
+
+    void pop() {
+        if (hasValue(events_[head_])) {
+            valueAt(head_)->~T();
+        }
+
+        head_ = (head_ + 1) % events_.size();
+        size_--;
+    }
+
+    std::vector<Event> events_;
+    std::vector<Storage> values_;
+    size_t head_;
+    size_t size_;
+    bool overflowed_;
+};
+
+}
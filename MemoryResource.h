@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace cmc {
+
+// Runtime source of memory for the internal arrays of the containers, in the
+// spirit of std::pmr::memory_resource.
+class MemoryResource {
+public:
+    virtual ~MemoryResource() = default;
+
+    virtual void* allocate(size_t bytes, size_t alignment) = 0;
+    virtual void deallocate(void* p, size_t bytes, size_t alignment) = 0;
+};
+
+// Over-aligned requests get a larger block from operator new, and the address
+// it returned is stored just before the aligned one for deallocate().
+class NewDeleteResource final : public MemoryResource {
+public:
+    void* allocate(size_t bytes, size_t alignment) override {
+        if (alignment <= alignof(std::max_align_t)) {
+            return ::operator new(bytes);
+        }
+
+        void* block = ::operator new(bytes + alignment + sizeof(void*));
+        uintptr_t address = reinterpret_cast<uintptr_t>(block) + sizeof(void*);
+        uintptr_t aligned = (address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+        reinterpret_cast<void**>(aligned)[-1] = block;
+
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void deallocate(void* p, size_t, size_t alignment) override {
+        if (alignment <= alignof(std::max_align_t)) {
+            ::operator delete(p);
+        } else {
+            ::operator delete(static_cast<void**>(p)[-1]);
+        }
+    }
+};
+
+inline MemoryResource* newDeleteResource() {
+    static NewDeleteResource resource;
+    return &resource;
+}
+
+// Hands out memory from a caller-provided buffer and never reuses it. When the
+// buffer is exhausted the request goes to the upstream resource, or fails with
+// std::bad_alloc if there is none.
+class MonotonicResource final : public MemoryResource {
+public:
+    explicit MonotonicResource(void* buffer, size_t bytes, MemoryResource* upstream = nullptr)
+    : begin_(static_cast<unsigned char*>(buffer))
+    , current_(static_cast<unsigned char*>(buffer))
+    , end_(static_cast<unsigned char*>(buffer) + bytes)
+    , upstream_(upstream)
+    {}
+
+    MonotonicResource(const MonotonicResource& obj) = delete;
+    const MonotonicResource& operator=(const MonotonicResource& obj) = delete;
+
+    void* allocate(size_t bytes, size_t alignment) override {
+        uintptr_t address = reinterpret_cast<uintptr_t>(current_);
+        uintptr_t aligned = (address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+        if (aligned + bytes > reinterpret_cast<uintptr_t>(end_)) {
+            if (upstream_ == nullptr) {
+                throw std::bad_alloc();
+            }
+
+            return upstream_->allocate(bytes, alignment);
+        }
+
+        current_ = reinterpret_cast<unsigned char*>(aligned + bytes);
+
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void deallocate(void* p, size_t bytes, size_t alignment) override {
+        unsigned char* address = static_cast<unsigned char*>(p);
+
+        if ((address < begin_) || (address >= end_)) {
+            upstream_->deallocate(p, bytes, alignment);
+        }
+    }
+
+    size_t getRemaining() const {
+        return static_cast<size_t>(end_ - current_);
+    }
+
+private:
+    unsigned char* begin_;
+    unsigned char* current_;
+    unsigned char* end_;
+    MemoryResource* upstream_;
+};
+
+template<class U>
+class PolyAllocator {
+public:
+    typedef U value_type;
+
+    PolyAllocator()
+    : resource_(newDeleteResource())
+    {}
+
+    PolyAllocator(MemoryResource* resource)
+    : resource_(resource != nullptr ? resource : newDeleteResource())
+    {}
+
+    template<class V>
+    PolyAllocator(const PolyAllocator<V>& obj)
+    : resource_(obj.getResource())
+    {}
+
+    U* allocate(size_t count) {
+        return static_cast<U*>(resource_->allocate(count * sizeof(U), alignof(U)));
+    }
+
+    void deallocate(U* p, size_t count) {
+        resource_->deallocate(p, count * sizeof(U), alignof(U));
+    }
+
+    MemoryResource* getResource() const {
+        return resource_;
+    }
+
+    template<class V>
+    bool operator==(const PolyAllocator<V>& obj) const {
+        return resource_ == obj.getResource();
+    }
+
+    template<class V>
+    bool operator!=(const PolyAllocator<V>& obj) const {
+        return resource_ != obj.getResource();
+    }
+
+private:
+    MemoryResource* resource_;
+};
+
+template<class U>
+using Vector = std::vector<U, PolyAllocator<U>>;
+
+}
@@ -1,15 +1,20 @@
 #pragma once
 
+#include <utility>
 #include <vector>
 
 namespace cmc {
 
 template <class T> class Container;
+template <class T> class Ref;
+template <class T> class WeakPtr;
 
 template<class T>
 class Ptr final {
 public:
     friend Container<T>;
+    friend Ref<T>;
+    friend WeakPtr<T>;
 
     Ptr() = delete;
 
@@ -17,9 +22,16 @@ public:
     : c_(obj.c_)
     , index_(obj.index_)
     {
-        unsigned int objIndex = c_->ptrOffset_[index_];
+        if (c_ == nullptr) {
+            return;
+        }
+
+        c_->checkPtrChange();
+        c_->checkPtrCapacity(1);
+
+        unsigned int slot = c_->ptrOffset_[index_];
         c_->ptrAddress_.emplace_back(this);
-        c_->ptrOffset_.emplace_back(objIndex);
+        c_->ptrOffset_.emplace_back(slot);
         index_ = c_->ptrOffset_.size() - 1;
 
         c_->incRefOf(index_);
@@ -29,7 +41,11 @@ public:
     : c_(obj.c_)
     , index_(obj.index_)
     {
+        if (c_ == nullptr) {
+            return;
+        }
 
+        c_->checkPtrChange();
         c_->ptrAddress_[index_] = this;
 
         obj.c_ = nullptr;
@@ -50,17 +66,21 @@ public:
             return;
         }
 
-        c_->decRefOf(index_);
+        c_->checkPtrChange();
 
-        if (c_->getRefCount(index_) == 0) {
-            c_->clearContainedElement(index_);
-        }
+        unsigned int slot = c_->ptrOffset_[index_];
 
         c_->clearPointer(index_);
+        c_->releaseSlot(slot);
     }
 
     T* operator->() {
-        unsigned int eleIndex = c_->ptrOffset_[index_];
+        unsigned int eleIndex = c_->getElementIndex(index_);
+
+        if (c_->trackDirty_) {
+            c_->setDirty(eleIndex);
+        }
+
         return &(c_->objects_[eleIndex]);
     }
 
@@ -74,22 +94,51 @@ public:
     }
 
     const Ptr<T>& operator=(const Ptr<T>& obj) {
-        c_->decRefOf(index_);
+        if ((c_ == nullptr) || (c_ != obj.c_)) {
+            Ptr<T> tmp(obj);
+            swapWith(tmp);
+            return *this;
+        }
 
-        if (c_->getRefCount(index_) == 0) {
-            c_->clearContainedElement(index_);
+        c_->checkPtrChange();
+
+        unsigned int oldSlot = c_->ptrOffset_[index_];
+        unsigned int slot = c_->ptrOffset_[obj.index_];
+
+        if (oldSlot == slot) {
+            return *this;
         }
 
-        c_ = obj.c_;
+        c_->incRefOf(obj.index_);
+        c_->ptrOffset_[index_] = slot;
+        c_->releaseSlot(oldSlot);
 
-        c_->ptrOffset_[index_] = c_->ptrOffset_[obj.index_];
+        return *this;
+    }
 
-        c_->incRefOf(index_);
+    const Ptr<T>& operator=(Ptr<T>&& obj) {
+        if (this != &obj) {
+            Ptr<T> tmp(std::move(obj));
+            swapWith(tmp);
+        }
 
         return *this;
     }
 
 private:
+    void swapWith(Ptr<T>& obj) {
+        std::swap(c_, obj.c_);
+        std::swap(index_, obj.index_);
+
+        if (c_ != nullptr) {
+            c_->ptrAddress_[index_] = this;
+        }
+
+        if (obj.c_ != nullptr) {
+            obj.c_->ptrAddress_[obj.index_] = &obj;
+        }
+    }
+
     Container<T>* c_;
     unsigned int index_;
 };
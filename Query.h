@@ -0,0 +1,457 @@
+#pragma once
+
+#include "Container.h"
+#include "Handle.h"
+#include "Storage.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace cmc {
+
+enum CompareOp {
+    kLess,
+    kLessEqual,
+    kGreater,
+    kGreaterEqual,
+    kEqual,
+    kNotEqual
+};
+
+// Instruction set used by the query kernels. The best one supported by the
+// CPU is picked on first use.
+enum QueryKernel {
+    kScalarKernel,
+    kSse2Kernel,
+    kAvx2Kernel
+};
+
+// Predicate on a field of every object, given by its byte offset and type,
+// e.g. Where<unsigned int>(offsetof(BigObject, uValue), kGreater, 10U).
+template<class U>
+class Where final {
+public:
+    static_assert(std::is_same<U, float>::value || std::is_same<U, int32_t>::value || std::is_same<U, uint32_t>::value,
+                  "cmc::Where supports float, int32_t and uint32_t fields");
+
+    explicit Where(size_t offset, CompareOp op, U value)
+    : offset_(offset)
+    , op_(op)
+    , value_(value)
+    {}
+
+    size_t getOffset() const {
+        return offset_;
+    }
+
+    CompareOp getOp() const {
+        return op_;
+    }
+
+    U getValue() const {
+        return value_;
+    }
+
+private:
+    size_t offset_;
+    CompareOp op_;
+    U value_;
+};
+
+namespace detail {
+
+inline QueryKernel detectQueryKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return kAvx2Kernel;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return kSse2Kernel;
+    }
+#endif
+
+    return kScalarKernel;
+}
+
+inline QueryKernel& currentQueryKernel() {
+    static QueryKernel kernel = detectQueryKernel();
+    return kernel;
+}
+
+template<class U>
+using MatchFunc = uint64_t (*)(const unsigned char* base, size_t stride, size_t count, U value);
+
+template<class U>
+U loadField(const unsigned char* p) {
+    U value;
+    std::memcpy(&value, p, sizeof(U));
+    return value;
+}
+
+template<CompareOp Op, class U>
+bool compareScalar(U a, U k) {
+    switch (Op) {
+    case kLess:
+        return a < k;
+    case kLessEqual:
+        return a <= k;
+    case kGreater:
+        return a > k;
+    case kGreaterEqual:
+        return a >= k;
+    case kEqual:
+        return a == k;
+    case kNotEqual:
+        return a != k;
+    }
+
+    return false;
+}
+
+// Bit i of the result is set when the field of object i matches, for at most
+// 64 objects.
+template<class U, CompareOp Op>
+uint64_t matchScalar(const unsigned char* base, size_t stride, size_t count, U value) {
+    uint64_t bits = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        bits |= static_cast<uint64_t>(compareScalar<Op>(loadField<U>(base + i * stride), value)) << i;
+    }
+
+    return bits;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template<class U>
+int32_t fieldBits(U value) {
+    int32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+__attribute__((target("sse2")))
+inline __m128i loadSse2(const unsigned char* p, size_t stride) {
+    if (stride == sizeof(int32_t)) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    return _mm_set_epi32(loadField<int32_t>(p + 3 * stride), loadField<int32_t>(p + 2 * stride),
+                         loadField<int32_t>(p + stride), loadField<int32_t>(p));
+}
+
+template<CompareOp Op>
+__attribute__((target("sse2")))
+inline __m128i compareSse2(__m128i a, __m128i k, float) {
+    __m128 x = _mm_castsi128_ps(a);
+    __m128 y = _mm_castsi128_ps(k);
+
+    switch (Op) {
+    case kLess:
+        return _mm_castps_si128(_mm_cmplt_ps(x, y));
+    case kLessEqual:
+        return _mm_castps_si128(_mm_cmple_ps(x, y));
+    case kGreater:
+        return _mm_castps_si128(_mm_cmpgt_ps(x, y));
+    case kGreaterEqual:
+        return _mm_castps_si128(_mm_cmpge_ps(x, y));
+    case kEqual:
+        return _mm_castps_si128(_mm_cmpeq_ps(x, y));
+    case kNotEqual:
+        return _mm_castps_si128(_mm_cmpneq_ps(x, y));
+    }
+
+    return _mm_setzero_si128();
+}
+
+template<CompareOp Op>
+__attribute__((target("sse2")))
+inline __m128i compareSse2(__m128i a, __m128i k, int32_t) {
+    __m128i ones = _mm_set1_epi32(-1);
+
+    switch (Op) {
+    case kLess:
+        return _mm_cmplt_epi32(a, k);
+    case kLessEqual:
+        return _mm_xor_si128(_mm_cmpgt_epi32(a, k), ones);
+    case kGreater:
+        return _mm_cmpgt_epi32(a, k);
+    case kGreaterEqual:
+        return _mm_xor_si128(_mm_cmplt_epi32(a, k), ones);
+    case kEqual:
+        return _mm_cmpeq_epi32(a, k);
+    case kNotEqual:
+        return _mm_xor_si128(_mm_cmpeq_epi32(a, k), ones);
+    }
+
+    return _mm_setzero_si128();
+}
+
+// Flipping the sign bit maps unsigned order onto signed order.
+template<CompareOp Op>
+__attribute__((target("sse2")))
+inline __m128i compareSse2(__m128i a, __m128i k, uint32_t) {
+    __m128i sign = _mm_set1_epi32(INT32_MIN);
+    return compareSse2<Op>(_mm_xor_si128(a, sign), _mm_xor_si128(k, sign), int32_t());
+}
+
+template<class U, CompareOp Op>
+__attribute__((target("sse2")))
+uint64_t matchSse2(const unsigned char* base, size_t stride, size_t count, U value) {
+    __m128i k = _mm_set1_epi32(fieldBits(value));
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i mask = compareSse2<Op>(loadSse2(base + i * stride, stride), k, U());
+        bits |= static_cast<uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(mask))) << i;
+    }
+
+    if (i < count) {
+        bits |= matchScalar<U, Op>(base + i * stride, stride, count - i, value) << i;
+    }
+
+    return bits;
+}
+
+template<CompareOp Op>
+__attribute__((target("avx2")))
+inline __m256i compareAvx2(__m256i a, __m256i k, float) {
+    __m256 x = _mm256_castsi256_ps(a);
+    __m256 y = _mm256_castsi256_ps(k);
+
+    switch (Op) {
+    case kLess:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_LT_OQ));
+    case kLessEqual:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_LE_OQ));
+    case kGreater:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_GT_OQ));
+    case kGreaterEqual:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_GE_OQ));
+    case kEqual:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_EQ_OQ));
+    case kNotEqual:
+        return _mm256_castps_si256(_mm256_cmp_ps(x, y, _CMP_NEQ_UQ));
+    }
+
+    return _mm256_setzero_si256();
+}
+
+template<CompareOp Op>
+__attribute__((target("avx2")))
+inline __m256i compareAvx2(__m256i a, __m256i k, int32_t) {
+    __m256i ones = _mm256_set1_epi32(-1);
+
+    switch (Op) {
+    case kLess:
+        return _mm256_cmpgt_epi32(k, a);
+    case kLessEqual:
+        return _mm256_xor_si256(_mm256_cmpgt_epi32(a, k), ones);
+    case kGreater:
+        return _mm256_cmpgt_epi32(a, k);
+    case kGreaterEqual:
+        return _mm256_xor_si256(_mm256_cmpgt_epi32(k, a), ones);
+    case kEqual:
+        return _mm256_cmpeq_epi32(a, k);
+    case kNotEqual:
+        return _mm256_xor_si256(_mm256_cmpeq_epi32(a, k), ones);
+    }
+
+    return _mm256_setzero_si256();
+}
+
+template<CompareOp Op>
+__attribute__((target("avx2")))
+inline __m256i compareAvx2(__m256i a, __m256i k, uint32_t) {
+    __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    return compareAvx2<Op>(_mm256_xor_si256(a, sign), _mm256_xor_si256(k, sign), int32_t());
+}
+
+// Fields of consecutive objects are gathered eight at a time, or loaded
+// directly when they are contiguous.
+template<class U, CompareOp Op>
+__attribute__((target("avx2")))
+uint64_t matchAvx2(const unsigned char* base, size_t stride, size_t count, U value) {
+    __m256i k = _mm256_set1_epi32(fieldBits(value));
+    int32_t s = static_cast<int32_t>(stride);
+    __m256i offsets = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+    bool contiguous = (stride == sizeof(int32_t));
+
+    uint64_t bits = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        const unsigned char* p = base + i * stride;
+        __m256i a = contiguous ? _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+                               : _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), offsets, 1);
+
+        __m256i mask = compareAvx2<Op>(a, k, U());
+        bits |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(mask))) << i;
+    }
+
+    if (i < count) {
+        bits |= matchScalar<U, Op>(base + i * stride, stride, count - i, value) << i;
+    }
+
+    return bits;
+}
+
+#endif
+
+template<class U, CompareOp Op>
+MatchFunc<U> matchFor(QueryKernel kernel) {
+    switch (kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    case kAvx2Kernel:
+        return &matchAvx2<U, Op>;
+    case kSse2Kernel:
+        return &matchSse2<U, Op>;
+#endif
+    default:
+        return &matchScalar<U, Op>;
+    }
+}
+
+template<class U>
+MatchFunc<U> matchFor(CompareOp op, size_t stride) {
+    QueryKernel kernel = currentQueryKernel();
+
+    // Gather offsets are 32-bit.
+    if ((kernel == kAvx2Kernel) && (stride > INT32_MAX / 8)) {
+        kernel = kSse2Kernel;
+    }
+
+    switch (op) {
+    case kLess:
+        return matchFor<U, kLess>(kernel);
+    case kLessEqual:
+        return matchFor<U, kLessEqual>(kernel);
+    case kGreater:
+        return matchFor<U, kGreater>(kernel);
+    case kGreaterEqual:
+        return matchFor<U, kGreaterEqual>(kernel);
+    case kEqual:
+        return matchFor<U, kEqual>(kernel);
+    case kNotEqual:
+        return matchFor<U, kNotEqual>(kernel);
+    }
+
+    throw std::invalid_argument("cmc: unknown comparison");
+}
+
+template<class T, class U>
+void checkField(size_t offset) {
+    if (offset + sizeof(U) > sizeof(T)) {
+        throw std::invalid_argument("cmc: field does not fit in the object");
+    }
+}
+
+// Calls f(first, bits) for every block of 64 objects, where bit i of bits
+// tells whether the object at position first + i matches.
+template<class T, class U, typename F>
+void forEachMatchBlock(const Container<T>& c, const Where<U>& where, F f) {
+    checkField<T, U>(where.getOffset());
+
+    MatchFunc<U> match = matchFor<U>(where.getOp(), sizeof(T));
+    size_t first = 0;
+
+    forEachPageOf(c.getObjects(), [&](const T* page, size_t count) {
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(page) + where.getOffset();
+
+        for (size_t i = 0; i < count; i += 64) {
+            size_t n = ((count - i) < 64) ? (count - i) : 64;
+            f(first + i, match(base + i * sizeof(T), sizeof(T), n, where.getValue()));
+        }
+
+        first += count;
+    });
+}
+
+template<typename F>
+void forEachBit(size_t first, uint64_t bits, F f) {
+    while (bits != 0) {
+        f(first + static_cast<size_t>(__builtin_ctzll(bits)));
+        bits &= bits - 1;
+    }
+}
+
+}
+
+inline QueryKernel getQueryKernel() {
+    return detail::currentQueryKernel();
+}
+
+// Selects the kernels used by later queries, e.g. to compare them. Kernels
+// the CPU does not support are replaced by the best supported one. Not
+// thread safe.
+inline void setQueryKernel(QueryKernel kernel) {
+    QueryKernel best = detail::detectQueryKernel();
+    detail::currentQueryKernel() = (kernel > best) ? best : kernel;
+}
+
+template<class T, class U>
+size_t countIf(const Container<T>& c, const Where<U>& where) {
+    size_t count = 0;
+
+    detail::forEachMatchBlock(c, where, [&count](size_t, uint64_t bits) {
+        count += static_cast<size_t>(__builtin_popcountll(bits));
+    });
+
+    return count;
+}
+
+// Appends the positions in the object array of the matching objects, in
+// order. Positions are valid until the container changes.
+template<class T, class U>
+void filter(const Container<T>& c, const Where<U>& where, std::vector<unsigned int>& positions) {
+    detail::forEachMatchBlock(c, where, [&positions](size_t first, uint64_t bits) {
+        detail::forEachBit(first, bits, [&positions](size_t pos) {
+            positions.emplace_back(static_cast<unsigned int>(pos));
+        });
+    });
+}
+
+// Appends handles to the matching objects, in array order.
+template<class T, class U>
+void selectInto(const Container<T>& c, const Where<U>& where, std::vector<Handle<T>>& out) {
+    const Vector<unsigned int>& slots = c.getObjectSlots();
+    const Vector<unsigned int>& generations = c.getSlotGenerations();
+
+    detail::forEachMatchBlock(c, where, [&](size_t first, uint64_t bits) {
+        detail::forEachBit(first, bits, [&](size_t pos) {
+            unsigned int slot = slots[pos];
+            out.emplace_back(slot, generations[slot]);
+        });
+    });
+}
+
+// Sums the field of type V at offset over the matching objects.
+template<class V, class T, class U>
+V reduce(const Container<T>& c, size_t offset, const Where<U>& where) {
+    detail::checkField<T, V>(offset);
+
+    const typename Container<T>::Storage& objects = c.getObjects();
+    V sum = V();
+
+    detail::forEachMatchBlock(c, where, [&](size_t first, uint64_t bits) {
+        detail::forEachBit(first, bits, [&](size_t pos) {
+            sum += detail::loadField<V>(reinterpret_cast<const unsigned char*>(&objects[pos]) + offset);
+        });
+    });
+
+    return sum;
+}
+
+}
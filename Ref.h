@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Handle.h"
+
+#include <cassert>
+
+namespace cmc {
+
+template <class T> class Container;
+template <class T> class Ptr;
+
+// Borrowed reference to an object, for loops that only read or write through
+// a pointer and do not need to own it. It registers nothing and is a plain
+// pointer in release builds, so it is only valid while the container does not
+// create, destroy or reorder objects. Debug builds remember the container
+// epoch and assert on use after such a change.
+template<class T>
+class Ref final {
+public:
+    explicit Ref(const Ptr<T>& ptr)
+    : p_(&(ptr.c_->objects_[ptr.c_->getElementIndex(ptr.index_)]))
+#ifndef NDEBUG
+    , c_(ptr.c_)
+    , epoch_(ptr.c_->getEpoch())
+#endif
+    {
+#ifdef NDEBUG
+        static_assert(sizeof(Ref<T>) == sizeof(T*), "cmc::Ref must be pointer sized in release builds");
+#endif
+    }
+
+    // The handle must be valid.
+    explicit Ref(Container<T>& c, Handle<T> handle)
+    : p_(c.get(handle))
+#ifndef NDEBUG
+    , c_(&c)
+    , epoch_(c.getEpoch())
+#endif
+    {
+        assert(p_ != nullptr && "cmc::Ref from an invalid handle");
+    }
+
+    template<typename A> Ref(A) = delete;
+
+    T* operator->() const {
+        check();
+        return p_;
+    }
+
+    T& operator*() const {
+        check();
+        return *p_;
+    }
+
+    T* get() const {
+        check();
+        return p_;
+    }
+
+    bool operator==(const Ref<T>& obj) const {
+        return p_ == obj.p_;
+    }
+
+    bool operator!=(const Ref<T>& obj) const {
+        return p_ != obj.p_;
+    }
+
+private:
+    void check() const {
+#ifndef NDEBUG
+        assert(c_->getEpoch() == epoch_ && "cmc::Ref used after its container changed");
+#endif
+    }
+
+    T* p_;
+#ifndef NDEBUG
+    const Container<T>* c_;
+    unsigned long long epoch_;
+#endif
+};
+
+}
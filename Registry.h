@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Container.h"
+
+namespace cmc {
+
+namespace detail {
+
+// Pointer to the container of T on the calling thread. It is a trivial
+// thread_local, so reading it needs no initialization guard.
+template<class T>
+Container<T>*& currentContainer() {
+    static thread_local Container<T>* current = nullptr;
+    return current;
+}
+
+template<class T>
+struct RegistryEntry final {
+    RegistryEntry() {
+        live() = true;
+    }
+
+    // Runs before the container is destroyed, so pointers released by the
+    // objects being destroyed know the container is already gone.
+    ~RegistryEntry() {
+        live() = false;
+        currentContainer<T>() = nullptr;
+    }
+
+    static bool& live() {
+        static thread_local bool flag = false;
+        return flag;
+    }
+
+    Container<T> container;
+};
+
+template<class T>
+__attribute__((noinline)) Container<T>& createContainer() {
+    static thread_local RegistryEntry<T> entry;
+    currentContainer<T>() = &(entry.container);
+    return entry.container;
+}
+
+}
+
+// Container designated for the objects of type T on the calling thread. It is
+// created on first use and destroyed when the thread exits. After the first
+// call a lookup is a single thread-local load.
+template<class T>
+inline Container<T>& containerFor() {
+    Container<T>* c = detail::currentContainer<T>();
+
+    if (__builtin_expect(c != nullptr, 1)) {
+        return *c;
+    }
+
+    return detail::createContainer<T>();
+}
+
+template<class T>
+bool hasContainerFor() {
+    return detail::RegistryEntry<T>::live();
+}
+
+}
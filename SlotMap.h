@@ -0,0 +1,177 @@
+#pragma once
+
+#include "MemoryResource.h"
+#include "Storage.h"
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace cmc {
+
+// Maps stable slots to positions in a packed array. Handles reference a slot
+// instead of an object, and every used slot is owned by exactly one object,
+// so moving an object only needs its slot retargeted.
+class SlotMap final {
+public:
+    SlotMap() = default;
+
+    explicit SlotMap(MemoryResource* resource)
+    : slotOffset_(resource)
+    , slotGeneration_(resource)
+    , freeSlots_(resource)
+    , objectSlot_(resource)
+    {}
+
+    void reserve(size_t count) {
+        slotOffset_.reserve(count);
+        slotGeneration_.reserve(count);
+        freeSlots_.reserve(count);
+        objectSlot_.reserve(count);
+    }
+
+    unsigned int acquire(unsigned int eleIndex) {
+        unsigned int slot;
+
+        if (freeSlots_.empty()) {
+            slot = static_cast<unsigned int>(slotOffset_.size());
+            slotOffset_.emplace_back(eleIndex);
+            slotGeneration_.emplace_back(0U);
+        } else {
+            slot = freeSlots_.back();
+            freeSlots_.pop_back();
+            slotOffset_[slot] = eleIndex;
+        }
+
+        objectSlot_.emplace_back(slot);
+
+        return slot;
+    }
+
+    // Mirrors a swap-and-pop of the packed array: the last object takes the
+    // position of the removed one, and the removed slot becomes reusable.
+    void erase(unsigned int remSlot) {
+        size_t lastElem = objectSlot_.size() - 1;
+        size_t remElem = slotOffset_[remSlot];
+
+        if (remElem != lastElem) {
+            unsigned int lastSlot = objectSlot_[lastElem];
+            objectSlot_[remElem] = lastSlot;
+            slotOffset_[lastSlot] = static_cast<unsigned int>(remElem);
+        }
+
+        objectSlot_.pop_back();
+
+        slotGeneration_[remSlot]++;
+        freeSlots_.emplace_back(remSlot);
+    }
+
+    void clear() {
+        for (unsigned int slot : objectSlot_) {
+            slotGeneration_[slot]++;
+            freeSlots_.emplace_back(slot);
+        }
+
+        objectSlot_.clear();
+    }
+
+    // Mirrors detail::permute() of the packed array.
+    void permute(const std::vector<unsigned int>& order, std::vector<bool>& placed) {
+        detail::permute(objectSlot_, order, placed);
+
+        size_t count = objectSlot_.size();
+        for (size_t i = 0; i < count; ++i) {
+            slotOffset_[objectSlot_[i]] = static_cast<unsigned int>(i);
+        }
+    }
+
+    void swapElements(size_t a, size_t b) {
+        std::swap(objectSlot_[a], objectSlot_[b]);
+
+        slotOffset_[objectSlot_[a]] = static_cast<unsigned int>(a);
+        slotOffset_[objectSlot_[b]] = static_cast<unsigned int>(b);
+    }
+
+    bool isValid(unsigned int slot, unsigned int generation) const {
+        return  (slot < slotGeneration_.size()) &&
+                (slotGeneration_[slot] == generation);
+    }
+
+    unsigned int getOffset(unsigned int slot) const {
+        return slotOffset_[slot];
+    }
+
+    unsigned int getGeneration(unsigned int slot) const {
+        return slotGeneration_[slot];
+    }
+
+    unsigned int getSlot(unsigned int eleIndex) const {
+        return objectSlot_[eleIndex];
+    }
+
+    const Vector<unsigned int>& getSlotOffsets() const {
+        return slotOffset_;
+    }
+
+    const Vector<unsigned int>& getSlotGenerations() const {
+        return slotGeneration_;
+    }
+
+    const Vector<unsigned int>& getObjectSlots() const {
+        return objectSlot_;
+    }
+
+    const Vector<unsigned int>& getFreeSlots() const {
+        return freeSlots_;
+    }
+
+    // Checks tables read from outside, e.g. from a snapshot: every object has
+    // its own slot pointing back at it, and every other slot is free exactly
+    // once.
+    static bool isConsistent(const unsigned int* objectSlot, size_t objectCount,
+                             const unsigned int* slotOffset, size_t slotCount,
+                             const unsigned int* freeSlots, size_t freeCount) {
+        if ((objectCount > slotCount) || (freeCount != slotCount - objectCount)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < objectCount; ++i) {
+            if ((objectSlot[i] >= slotCount) || (slotOffset[objectSlot[i]] != i)) {
+                return false;
+            }
+        }
+
+        std::vector<bool> freed(slotCount, false);
+
+        for (size_t i = 0; i < freeCount; ++i) {
+            unsigned int slot = freeSlots[i];
+
+            if ((slot >= slotCount) || freed[slot] ||
+                ((slotOffset[slot] < objectCount) && (objectSlot[slotOffset[slot]] == slot))) {
+                return false;
+            }
+
+            freed[slot] = true;
+        }
+
+        return true;
+    }
+
+    // Replaces every table, e.g. with the ones of a snapshot.
+    void assign(const unsigned int* objectSlot, size_t objectCount,
+                const unsigned int* slotOffset, const unsigned int* slotGeneration, size_t slotCount,
+                const unsigned int* freeSlots, size_t freeCount) {
+        objectSlot_.assign(objectSlot, objectSlot + objectCount);
+        slotOffset_.assign(slotOffset, slotOffset + slotCount);
+        slotGeneration_.assign(slotGeneration, slotGeneration + slotCount);
+        freeSlots_.assign(freeSlots, freeSlots + freeCount);
+    }
+
+private:
+    Vector<unsigned int> slotOffset_;
+    Vector<unsigned int> slotGeneration_;
+    Vector<unsigned int> freeSlots_;
+    Vector<unsigned int> objectSlot_;
+};
+
+}
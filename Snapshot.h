@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cmc {
+
+namespace detail {
+
+// Snapshot layout: the header, then every array starting on a multiple of
+// kSnapshotAlign bytes: objects, object slots, slot offsets, slot
+// generations and free slots.
+struct SnapshotHeader {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t objectSize;
+    uint64_t objectAlign;
+    uint64_t objectCount;
+    uint64_t slotCount;
+    uint64_t freeCount;
+    uint64_t reserved;
+};
+
+static const uint64_t kSnapshotMagic = 0x31504e53434d43ULL;
+static const uint64_t kSnapshotVersion = 2;
+static const size_t kSnapshotAlign = 64;
+
+inline size_t alignSnapshot(size_t offset) {
+    return (offset + kSnapshotAlign - 1) & ~(kSnapshotAlign - 1);
+}
+
+// Returns where an array of count elements starting at offset ends, and
+// throws if it does not fit in a file of fileSize bytes.
+inline size_t endOfSnapshotArray(size_t offset, uint64_t count, size_t elementSize, size_t fileSize) {
+    if ((offset > fileSize) || (count > (fileSize - offset) / elementSize)) {
+        throw std::runtime_error("cmc: snapshot is truncated");
+    }
+
+    return offset + static_cast<size_t>(count) * elementSize;
+}
+
+class SnapshotWriter final {
+public:
+    explicit SnapshotWriter(const char* path)
+    : file_(std::fopen(path, "wb"))
+    , offset_(0)
+    {
+        if (file_ == nullptr) {
+            throw std::runtime_error("cmc: cannot open snapshot for writing");
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter& obj) = delete;
+    const SnapshotWriter& operator=(const SnapshotWriter& obj) = delete;
+
+    ~SnapshotWriter() {
+        if (file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    void write(const void* data, size_t bytes) {
+        if ((bytes > 0) && (std::fwrite(data, 1, bytes, file_) != bytes)) {
+            throw std::runtime_error("cmc: cannot write snapshot");
+        }
+
+        offset_ += bytes;
+    }
+
+    void pad() {
+        static const unsigned char zeros[kSnapshotAlign] = {};
+        write(zeros, alignSnapshot(offset_) - offset_);
+    }
+
+    void close() {
+        FILE* file = file_;
+        file_ = nullptr;
+
+        if (std::fclose(file) != 0) {
+            throw std::runtime_error("cmc: cannot write snapshot");
+        }
+    }
+
+private:
+    FILE* file_;
+    size_t offset_;
+};
+
+// Read-only private mapping of a whole file.
+class MappedFile final {
+public:
+    explicit MappedFile(const char* path)
+    : data_(nullptr)
+    , size_(0)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cmc: cannot open snapshot for reading");
+        }
+
+        struct stat st;
+        if ((::fstat(fd, &st) != 0) || (st.st_size == 0)) {
+            ::close(fd);
+            throw std::runtime_error("cmc: cannot read snapshot");
+        }
+
+        size_ = static_cast<size_t>(st.st_size);
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("cmc: cannot map snapshot");
+        }
+
+        data_ = static_cast<const unsigned char*>(data);
+    }
+
+    MappedFile(const MappedFile& obj) = delete;
+    const MappedFile& operator=(const MappedFile& obj) = delete;
+
+    ~MappedFile() {
+        ::munmap(const_cast<unsigned char*>(data_), size_);
+    }
+
+    const unsigned char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const unsigned char* data_;
+    size_t size_;
+};
+
+}
+
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "Handle.h"
+#include "SlotMap.h"
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cmc {
+
+namespace detail {
+
+template<size_t... Is> struct IndexSequence {};
+
+template<size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
+
+template<size_t... Is>
+struct MakeIndexSequence<0, Is...> {
+    typedef IndexSequence<Is...> type;
+};
+
+template<class U, class... Ts>
+struct TypeCount {
+    static const size_t value = 0;
+};
+
+template<class U, class T, class... Ts>
+struct TypeCount<U, T, Ts...> {
+    static const size_t value = (std::is_same<U, T>::value ? 1 : 0) + TypeCount<U, Ts...>::value;
+};
+
+// Column of U among Ts, which must contain U exactly once.
+template<class U, class T, class... Ts>
+struct TypeIndex {
+    static const size_t value = 1 + TypeIndex<U, Ts...>::value;
+};
+
+template<class U, class... Ts>
+struct TypeIndex<U, U, Ts...> {
+    static_assert(TypeCount<U, Ts...>::value == 0, "cmc: component type appears more than once");
+    static const size_t value = 0;
+};
+
+}
+
+// Stores every field in its own contiguous column. All the columns share one
+// slot map, so a handle references a row and removal compacts every column
+// with the same swap-and-pop.
+//
+// When the fields are distinct types the container is an archetype: a row is
+// an entity holding one component of each type, columns can be reached by
+// type, and forEach<Us...>() walks the selected columns in lockstep.
+template<class... Fields>
+class SoAContainer final {
+public:
+    typedef Handle<SoAContainer<Fields...>> HandleType;
+
+    template<size_t I>
+    using FieldType = typename std::tuple_element<I, std::tuple<Fields...>>::type;
+
+    SoAContainer() = default;
+    SoAContainer(SoAContainer<Fields...>& obj) = delete;
+    SoAContainer(SoAContainer<Fields...>&& obj) = delete;
+
+    template<typename A> SoAContainer(A) = delete;
+
+    HandleType make(Fields... values) {
+        pushRow(Indices(), std::move(values)...);
+
+        unsigned int index = static_cast<unsigned int>(size() - 1);
+        unsigned int slot = slots_.acquire(index);
+
+        return HandleType(slot, slots_.getGeneration(slot));
+    }
+
+    bool isValid(HandleType handle) const {
+        return slots_.isValid(handle.getIndex(), handle.getGeneration());
+    }
+
+    void destroy(HandleType handle) {
+        if (!isValid(handle)) {
+            return;
+        }
+
+        eraseRow(Indices(), slots_.getOffset(handle.getIndex()));
+        slots_.erase(handle.getIndex());
+    }
+
+    template<size_t I>
+    FieldType<I>* get(HandleType handle) {
+        if (!isValid(handle)) {
+            return nullptr;
+        }
+
+        return &(std::get<I>(columns_)[slots_.getOffset(handle.getIndex())]);
+    }
+
+    template<class U>
+    U* get(HandleType handle) {
+        return get<detail::TypeIndex<U, Fields...>::value>(handle);
+    }
+
+    template<size_t I>
+    FieldType<I>* column() {
+        return std::get<I>(columns_).data();
+    }
+
+    template<size_t I>
+    const FieldType<I>* column() const {
+        return std::get<I>(columns_).data();
+    }
+
+    template<class U>
+    U* column() {
+        return column<detail::TypeIndex<U, Fields...>::value>();
+    }
+
+    template<class U>
+    const U* column() const {
+        return column<detail::TypeIndex<U, Fields...>::value>();
+    }
+
+    // Calls f(Us&...) for every row, reading each selected column
+    // sequentially.
+    template<class... Us, typename F>
+    void forEach(F f) {
+        forEachRow(f, size(), column<Us>()...);
+    }
+
+    template<class... Us, typename F>
+    void forEach(F f) const {
+        forEachRow(f, size(), column<Us>()...);
+    }
+
+    size_t size() const {
+        return std::get<0>(columns_).size();
+    }
+
+    const Vector<unsigned int>& getObjectSlots() const {
+        return slots_.getObjectSlots();
+    }
+
+    const SoAContainer<Fields...>& operator=(const SoAContainer<Fields...>& obj) = delete;
+    bool operator==(const SoAContainer<Fields...>& obj) = delete;
+    bool operator!=(const SoAContainer<Fields...>& obj) = delete;
+
+private:
+    typedef typename detail::MakeIndexSequence<sizeof...(Fields)>::type Indices;
+
+    template<size_t... Is>
+    void pushRow(detail::IndexSequence<Is...>, Fields&&... values) {
+        int expand[] = {0, (std::get<Is>(columns_).emplace_back(std::move(values)), 0)...};
+        (void)expand;
+    }
+
+    template<size_t... Is>
+    void eraseRow(detail::IndexSequence<Is...>, size_t remElem) {
+        int expand[] = {0, (eraseFrom(std::get<Is>(columns_), remElem), 0)...};
+        (void)expand;
+    }
+
+    template<typename F, class... Us>
+    static void forEachRow(F& f, size_t count, Us*... columns) {
+        for (size_t i = 0; i < count; ++i) {
+            f(columns[i]...);
+        }
+    }
+
+    template<class U>
+    static void eraseFrom(std::vector<U>& col, size_t remElem) {
+        size_t lastElem = col.size() - 1;
+
+        if (remElem != lastElem) {
+            col[remElem] = std::move(col[lastElem]);
+        }
+
+        col.pop_back();
+    }
+
+    SlotMap slots_;
+    std::tuple<std::vector<Fields>...> columns_;
+};
+
+template<class... Components>
+using Archetype = SoAContainer<Components...>;
+
+}
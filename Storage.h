@@ -0,0 +1,216 @@
+#pragma once
+
+#include "MemoryResource.h"
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace cmc {
+
+namespace detail {
+
+constexpr size_t floorLog2(size_t n) {
+    return (n <= 1) ? 0 : 1 + floorLog2(n / 2);
+}
+
+// Moves values[order[i]] to values[i] for every i. Each cycle of the
+// permutation is followed once, so every value is moved once and only one
+// temporary is needed.
+template<class A>
+void permute(A& values, const std::vector<unsigned int>& order, std::vector<bool>& placed) {
+    size_t count = order.size();
+    placed.assign(count, false);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (placed[i]) {
+            continue;
+        }
+
+        placed[i] = true;
+
+        if (order[i] == i) {
+            continue;
+        }
+
+        auto tmp(std::move(values[i]));
+
+        size_t j = i;
+        while (order[j] != i) {
+            values[j] = std::move(values[order[j]]);
+            j = order[j];
+            placed[j] = true;
+        }
+
+        values[j] = std::move(tmp);
+    }
+}
+
+}
+
+// Stores objects in fixed-size pages, so growing never relocates the objects
+// already stored. Pages hold a power of two number of objects, which keeps
+// element lookup to a shift and a mask.
+template<class T, size_t PageBytes = 65536>
+class PagedVector final {
+public:
+    static const size_t kPageShift = detail::floorLog2(PageBytes / sizeof(T));
+    static const size_t kPageSize = static_cast<size_t>(1) << kPageShift;
+    static const size_t kPageMask = kPageSize - 1;
+
+    explicit PagedVector(MemoryResource* resource = nullptr)
+    : pages_(resource)
+    , size_(0)
+    {}
+
+    PagedVector(const PagedVector<T, PageBytes>& obj) = delete;
+    const PagedVector<T, PageBytes>& operator=(const PagedVector<T, PageBytes>& obj) = delete;
+
+    ~PagedVector() {
+        clear();
+
+        MemoryResource* resource = getResource();
+        for (T* page : pages_) {
+            resource->deallocate(page, kPageSize * sizeof(T), alignof(T));
+        }
+    }
+
+    template<typename... Args>
+    void emplace_back(Args&&... args) {
+        if (size_ == pages_.size() * kPageSize) {
+            addPage();
+        }
+
+        ::new (static_cast<void*>(&(*this)[size_])) T(std::forward<Args>(args)...);
+        size_++;
+    }
+
+    void pop_back() {
+        size_--;
+        (*this)[size_].~T();
+    }
+
+    void clear() {
+        while (size_ > 0) {
+            pop_back();
+        }
+    }
+
+    void reserve(size_t count) {
+        while (pages_.size() * kPageSize < count) {
+            addPage();
+        }
+    }
+
+    T& operator[](size_t i) {
+        return pages_[i >> kPageShift][i & kPageMask];
+    }
+
+    const T& operator[](size_t i) const {
+        return pages_[i >> kPageShift][i & kPageMask];
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    size_t capacity() const {
+        return pages_.size() * kPageSize;
+    }
+
+    template<typename F>
+    void forEachPage(F f) {
+        size_t remaining = size_;
+
+        for (size_t i = 0; remaining > 0; ++i) {
+            size_t count = (remaining < kPageSize) ? remaining : kPageSize;
+            f(pages_[i], count);
+            remaining -= count;
+        }
+    }
+
+    template<typename F>
+    void forEachPage(F f) const {
+        size_t remaining = size_;
+
+        for (size_t i = 0; remaining > 0; ++i) {
+            size_t count = (remaining < kPageSize) ? remaining : kPageSize;
+            f(static_cast<const T*>(pages_[i]), count);
+            remaining -= count;
+        }
+    }
+
+    MemoryResource* getResource() const {
+        return pages_.get_allocator().getResource();
+    }
+
+    PolyAllocator<T> get_allocator() const {
+        return PolyAllocator<T>(getResource());
+    }
+
+private:
+    void addPage() {
+        void* page = getResource()->allocate(kPageSize * sizeof(T), alignof(T));
+        pages_.emplace_back(static_cast<T*>(page));
+    }
+
+    Vector<T*> pages_;
+    size_t size_;
+};
+
+template<class T, size_t PageBytes> const size_t PagedVector<T, PageBytes>::kPageShift;
+template<class T, size_t PageBytes> const size_t PagedVector<T, PageBytes>::kPageSize;
+template<class T, size_t PageBytes> const size_t PagedVector<T, PageBytes>::kPageMask;
+
+// Selects how a Container<T> stores its objects. Specialize it to store a type
+// in pages, e.g. typedef PagedVector<T, 65536> type;
+template<class T>
+struct ContainerStorage {
+    typedef Vector<T> type;
+};
+
+template<class T, typename F>
+void forEachPageOf(Vector<T>& objects, F f) {
+    if (!objects.empty()) {
+        f(objects.data(), objects.size());
+    }
+}
+
+template<class T, size_t PageBytes, typename F>
+void forEachPageOf(PagedVector<T, PageBytes>& objects, F f) {
+    objects.forEachPage(f);
+}
+
+template<class T, typename F>
+void forEachPageOf(const Vector<T>& objects, F f) {
+    if (!objects.empty()) {
+        f(objects.data(), objects.size());
+    }
+}
+
+template<class T, size_t PageBytes, typename F>
+void forEachPageOf(const PagedVector<T, PageBytes>& objects, F f) {
+    objects.forEachPage(f);
+}
+
+// Copies count objects to the end of the storage.
+template<class T>
+void appendRangeTo(Vector<T>& objects, const T* first, size_t count) {
+    objects.insert(objects.end(), first, first + count);
+}
+
+template<class T, size_t PageBytes>
+void appendRangeTo(PagedVector<T, PageBytes>& objects, const T* first, size_t count) {
+    objects.reserve(objects.size() + count);
+
+    for (size_t i = 0; i < count; ++i) {
+        objects.emplace_back(first[i]);
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Container.h"
+#include "Ptr.h"
+#include "Storage.h"
+
+// Objects shared by the tests in main.cpp and the benchmarks in bench.cpp.
+
+class BigObject final {
+public:
+    BigObject() = delete;
+    explicit BigObject(float f, unsigned int u)
+    : fValue{f, f, f, f, f, f, f, f, f, f}
+    , uValue{u, u, u, u, u, u, u, u, u, u}
+    {}
+
+    template<typename A, typename B> BigObject(A, B) = delete;
+
+    float fValue[10];
+    unsigned int uValue[10];
+};
+
+class ObjWithRef final {
+public:
+    ObjWithRef() = delete;
+    explicit ObjWithRef(float f, const cmc::Ptr<BigObject> ptr)
+    : fValue(f)
+    , ptrBO(ptr)
+    {}
+
+    template<typename A, typename B> ObjWithRef(A, B) = delete;
+
+    float fValue;
+    cmc::Ptr<BigObject> ptrBO;
+};
+
+class Position final {
+public:
+    Position() = delete;
+    explicit Position(float x, float y)
+    : x(x)
+    , y(y)
+    {}
+
+    template<typename A, typename B> Position(A, B) = delete;
+
+    float x;
+    float y;
+};
+
+class Velocity final {
+public:
+    Velocity() = delete;
+    explicit Velocity(float x, float y)
+    : x(x)
+    , y(y)
+    {}
+
+    template<typename A, typename B> Velocity(A, B) = delete;
+
+    float x;
+    float y;
+};
+
+class PagedBigObject final {
+public:
+    PagedBigObject() = delete;
+    explicit PagedBigObject(float f, unsigned int u)
+    : fValue{f, f, f, f, f, f, f, f, f, f}
+    , uValue{u, u, u, u, u, u, u, u, u, u}
+    {}
+
+    template<typename A, typename B> PagedBigObject(A, B) = delete;
+
+    float fValue[10];
+    unsigned int uValue[10];
+};
+
+struct BigObjectKey {
+    unsigned int operator()(const BigObject& obj) const {
+        return obj.uValue[0];
+    }
+};
+
+namespace cmc {
+
+template<>
+struct ContainerStorage<PagedBigObject> {
+    typedef PagedVector<PagedBigObject, 65536> type;
+};
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cmc {
+
+// Fixed set of threads running the tasks of one parallelFor() at a time. The
+// calling thread takes part too, so a pool of N threads spawns N - 1 workers.
+// Tasks are handed out through an atomic counter, so faster threads simply
+// take more of them.
+class ThreadPool final {
+public:
+    explicit ThreadPool(unsigned int threadCount)
+    : task_(nullptr)
+    , taskCount_(0)
+    , nextTask_(0)
+    , busy_(0)
+    , round_(0)
+    , stop_(false)
+    {
+        for (unsigned int i = 1; i < threadCount; ++i) {
+            threads_.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool& obj) = delete;
+    const ThreadPool& operator=(const ThreadPool& obj) = delete;
+
+    template<typename A> ThreadPool(A) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        wake_.notify_all();
+
+        for (std::thread& t : threads_) {
+            t.join();
+        }
+    }
+
+    unsigned int getThreadCount() const {
+        return static_cast<unsigned int>(threads_.size() + 1);
+    }
+
+    // Calls f(i) for every i in [0, taskCount) and returns once all the calls
+    // have finished. f must not throw.
+    template<typename F>
+    void parallelFor(size_t taskCount, F f) {
+        if (threads_.empty() || (taskCount <= 1)) {
+            for (size_t i = 0; i < taskCount; ++i) {
+                f(i);
+            }
+
+            return;
+        }
+
+        std::function<void(size_t)> task(f);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            taskCount_ = taskCount;
+            nextTask_.store(0, std::memory_order_relaxed);
+            busy_ = static_cast<unsigned int>(threads_.size());
+            round_++;
+        }
+
+        wake_.notify_all();
+
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return busy_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    void work() {
+        unsigned long long seen = 0;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen]() { return stop_ || (round_ != seen); });
+
+                if (stop_) {
+                    return;
+                }
+
+                seen = round_;
+            }
+
+            runTasks();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if (--busy_ == 0) {
+                    done_.notify_one();
+                }
+            }
+        }
+    }
+
+    void runTasks() {
+        size_t i;
+
+        while ((i = nextTask_.fetch_add(1, std::memory_order_relaxed)) < taskCount_) {
+            (*task_)(i);
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t)>* task_;
+    size_t taskCount_;
+    std::atomic<size_t> nextTask_;
+    unsigned int busy_;
+    unsigned long long round_;
+    bool stop_;
+};
+
+}
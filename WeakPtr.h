@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Handle.h"
+
+#include <stdexcept>
+
+namespace cmc {
+
+template <class T> class Container;
+template <class T> class Ptr;
+
+// Non-owning reference to an object of a container. It is a slot and a
+// generation, like Handle<T>, so copying it registers nothing and it does not
+// keep the object alive. It must not outlive its container.
+template<class T>
+class WeakPtr final {
+public:
+    WeakPtr()
+    : c_(nullptr)
+    {}
+
+    WeakPtr(const Ptr<T>& ptr)
+    : c_(ptr.c_)
+    {
+        if (c_ != nullptr) {
+            handle_ = c_->handleOf(ptr);
+        }
+    }
+
+    explicit WeakPtr(Container<T>* c, Handle<T> handle)
+    : c_(c)
+    , handle_(handle)
+    {}
+
+    template<typename A> WeakPtr(A) = delete;
+
+    bool expired() const {
+        return (c_ == nullptr) || !c_->isValid(handle_);
+    }
+
+    // Raw access without taking a reference. The result is null once the
+    // object is destroyed, and only valid until the container changes.
+    T* get() const {
+        return (c_ == nullptr) ? nullptr : c_->get(handle_);
+    }
+
+    // Takes a new reference to the object. Throws std::logic_error when the
+    // object is already destroyed.
+    Ptr<T> lock() const {
+        if (expired()) {
+            throw std::logic_error("cmc::WeakPtr has expired");
+        }
+
+        c_->checkPtrCapacity(1);
+
+        return c_->ptrTo(handle_.getIndex());
+    }
+
+    Handle<T> getHandle() const {
+        return handle_;
+    }
+
+    bool operator==(const WeakPtr<T>& obj) const {
+        return (c_ == obj.c_) && (handle_ == obj.handle_);
+    }
+
+    bool operator!=(const WeakPtr<T>& obj) const {
+        return !((*this) == obj);
+    }
+
+private:
+    Container<T>* c_;
+    Handle<T> handle_;
+};
+
+}
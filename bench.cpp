@@ -0,0 +1,1191 @@
+#include "Container.h"
+#include "Handle.h"
+#include "Index.h"
+#include "MemoryResource.h"
+#include "Ptr.h"
+#include "Query.h"
+#include "Ref.h"
+#include "Registry.h"
+#include "SoAContainer.h"
+#include "TestObjects.h"
+#include "ThreadPool.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace cmc;
+
+// Makes the compiler assume that value is read, so the code computing it is
+// not optimized away.
+template<typename V>
+inline void do_not_optimize(const V& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Drives the runs of one scenario at one size. The scenario calls next()
+// before every run; the clock runs from there until the following call,
+// except between pause() and resume(), so setup and teardown can be left out.
+// The first runs are warmup and are not recorded.
+class State final {
+public:
+    explicit State(size_t size, unsigned int warmup, unsigned int repeats)
+    : size_(size)
+    , items_(size)
+    , warmup_(warmup)
+    , runs_(warmup + repeats)
+    , run_(0)
+    , timing_(false)
+    , elapsed_(0.0)
+    {}
+
+    State(const State& obj) = delete;
+    const State& operator=(const State& obj) = delete;
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Items processed by one run, used for the time per item. Defaults to
+    // the size.
+    void setItems(size_t items) {
+        items_ = items;
+    }
+
+    size_t getItems() const {
+        return items_;
+    }
+
+    bool next() {
+        if (run_ > 0) {
+            pause();
+
+            if (run_ > warmup_) {
+                samples_.push_back(elapsed_);
+            }
+        }
+
+        if (run_ == runs_) {
+            return false;
+        }
+
+        run_++;
+        elapsed_ = 0.0;
+        resume();
+
+        return true;
+    }
+
+    void pause() {
+        if (timing_) {
+            elapsed_ += std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start_).count();
+            timing_ = false;
+        }
+    }
+
+    void resume() {
+        if (!timing_) {
+            timing_ = true;
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    const std::vector<double>& getSamples() const {
+        return samples_;
+    }
+
+private:
+    size_t size_;
+    size_t items_;
+    unsigned int warmup_;
+    unsigned int runs_;
+    unsigned int run_;
+    bool timing_;
+    double elapsed_;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<double> samples_;
+};
+
+struct Scenario {
+    std::string name;
+    std::function<void(State&)> run;
+};
+
+struct Result {
+    std::string name;
+    size_t size;
+    size_t items;
+    size_t repeats;
+    double median;
+    double p99;
+    double min;
+    double mean;
+};
+
+std::vector<unsigned int> shuffled_order(size_t count) {
+    std::vector<unsigned int> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = static_cast<unsigned int>(i);
+    }
+
+    std::mt19937 rng(1234U);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    return order;
+}
+
+template<class T>
+void release_ptrs(Container<T>& c, std::vector<Ptr<T>>& v) {
+    c.invalidatePtrs();
+    v.clear();
+}
+
+unsigned int sum_fields(const BigObject& obj) {
+    unsigned int sum = 0U;
+    for (unsigned int j = 0; j < 10U; ++j) {
+        sum += obj.uValue[j];
+    }
+
+    return sum;
+}
+
+void bench_create_new_and_vector(State& state) {
+    size_t n = state.size();
+
+    while (state.next()) {
+        std::vector<BigObject*> v1;
+
+        for (size_t i = 0; i < n; ++i) {
+            v1.emplace_back(new BigObject(1.0f, 1U));
+        }
+
+        state.pause();
+
+        for (BigObject* p : v1) {
+            delete p;
+        }
+    }
+}
+
+void bench_create_make(State& state) {
+    size_t n = state.size();
+
+    while (state.next()) {
+        Container<BigObject> c1;
+        std::vector<Ptr<BigObject>> v1;
+
+        for (size_t i = 0; i < n; ++i) {
+            v1.emplace_back(c1.make(1.0f, 1U));
+        }
+
+        state.pause();
+        release_ptrs(c1, v1);
+    }
+}
+
+void bench_create_make_n(State& state) {
+    size_t n = state.size();
+
+    while (state.next()) {
+        Container<BigObject> c1;
+        std::vector<Ptr<BigObject>> v1;
+
+        c1.makeN(v1, n, 1.0f, 1U);
+
+        state.pause();
+        release_ptrs(c1, v1);
+    }
+}
+
+void bench_create_make_handle(State& state) {
+    size_t n = state.size();
+
+    while (state.next()) {
+        Container<BigObject> c1;
+
+        for (size_t i = 0; i < n; ++i) {
+            c1.makeHandle(1.0f, 1U);
+        }
+
+        state.pause();
+    }
+}
+
+void bench_create_make_handle_fixed_capacity(State& state) {
+    size_t n = state.size();
+    std::vector<unsigned char> buffer(n * (sizeof(BigObject) + 64U) + 4096U);
+
+    while (state.next()) {
+        state.pause();
+        MonotonicResource arena(buffer.data(), buffer.size());
+        Container<BigObject> c1(&arena, n, n);
+        state.resume();
+
+        for (size_t i = 0; i < n; ++i) {
+            c1.makeHandle(1.0f, 1U);
+        }
+
+        state.pause();
+    }
+}
+
+void bench_create_make_handle_paged(State& state) {
+    size_t n = state.size();
+
+    while (state.next()) {
+        Container<PagedBigObject> c1;
+
+        for (size_t i = 0; i < n; ++i) {
+            c1.makeHandle(1.0f, 1U);
+        }
+
+        state.pause();
+    }
+}
+
+void bench_copy_ptrs(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        std::vector<Ptr<BigObject>> v2(v1);
+
+        state.pause();
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void bench_copy_handles(State& state) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        std::vector<Handle<BigObject>> v2(v1);
+        do_not_optimize(v2.data());
+
+        state.pause();
+    }
+}
+
+// Drops every pointer in random order, so each destruction moves the last
+// object into the hole.
+template<class T, typename MakeFunc>
+void run_random_destruction(State& state, bool deferred, bool collect, MakeFunc make) {
+    size_t n = state.size();
+    std::vector<unsigned int> order = shuffled_order(n);
+
+    while (state.next()) {
+        state.pause();
+
+        Container<T> c1;
+        c1.setDeferredDestruction(deferred);
+
+        std::vector<Ptr<T>> v2;
+        v2.reserve(n);
+
+        {
+            std::vector<Ptr<T>> v1;
+            v1.reserve(n);
+
+            for (size_t i = 0; i < n; ++i) {
+                v1.emplace_back(make(c1, static_cast<unsigned int>(i)));
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                v2.emplace_back(v1[order[i]]);
+            }
+        }
+
+        state.resume();
+
+        v2.clear();
+
+        if (collect) {
+            c1.collect();
+        }
+
+        state.pause();
+    }
+}
+
+Ptr<BigObject> make_big_object(Container<BigObject>& c, unsigned int i) {
+    return c.make(1.0f, i);
+}
+
+void bench_destroy_random_ptrs(State& state) {
+    run_random_destruction<BigObject>(state, false, false, make_big_object);
+}
+
+void bench_destroy_random_ptrs_deferred_drop(State& state) {
+    run_random_destruction<BigObject>(state, true, false, make_big_object);
+}
+
+void bench_destroy_random_ptrs_deferred_with_collect(State& state) {
+    run_random_destruction<BigObject>(state, true, true, make_big_object);
+}
+
+void bench_destroy_random_ptrs_holding_ptrs(State& state) {
+    Container<BigObject> c1;
+    Ptr<BigObject> shared = c1.make(1.0f, 1U);
+
+    run_random_destruction<ObjWithRef>(state, false, false, [&shared](Container<ObjWithRef>& c, unsigned int i) {
+        return c.make(static_cast<float>(i), shared);
+    });
+}
+
+void bench_destroy_ptrs_in_order(State& state) {
+    while (state.next()) {
+        state.pause();
+        Container<BigObject> c1;
+        std::vector<Ptr<BigObject>> v1;
+        c1.makeN(v1, state.size(), 1.0f, 1U);
+        state.resume();
+
+        v1.clear();
+
+        state.pause();
+    }
+}
+
+void bench_destroy_ptrs_in_bulk(State& state) {
+    while (state.next()) {
+        state.pause();
+        Container<BigObject> c1;
+        std::vector<Ptr<BigObject>> v1;
+        c1.makeN(v1, state.size(), 1.0f, 1U);
+        state.resume();
+
+        c1.destroy(v1);
+        v1.clear();
+
+        state.pause();
+    }
+}
+
+void bench_destroy_clear(State& state) {
+    while (state.next()) {
+        state.pause();
+        Container<BigObject> c1;
+        std::vector<Ptr<BigObject>> v1;
+        c1.makeN(v1, state.size(), 1.0f, 1U);
+        state.resume();
+
+        c1.clear();
+        v1.clear();
+
+        state.pause();
+    }
+}
+
+// Other allocations are interleaved with the objects, as in a long running
+// program, so the objects end up scattered over the heap: up to 10 per
+// object, but never more than 2M in total (160 MB), spread evenly.
+void bench_iterate_new_scattered(State& state) {
+    size_t n = state.size();
+    size_t countObstruct = std::min<size_t>(10U * n, 2000000U);
+
+    std::vector<BigObject*> v1;
+    std::vector<BigObject*> vObstruct;
+    vObstruct.reserve(countObstruct);
+
+    for (size_t i = 0; i < n; ++i) {
+        v1.emplace_back(new BigObject(1.0f, 1U));
+
+        while (vObstruct.size() < (i + 1) * countObstruct / n) {
+            vObstruct.emplace_back(new BigObject(1.0f, 1U));
+        }
+    }
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (BigObject* p : v1) {
+            sumU += sum_fields(*p);
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    for (BigObject* p : vObstruct) {
+        delete p;
+    }
+
+    for (BigObject* p : v1) {
+        delete p;
+    }
+}
+
+void bench_iterate_ptrs_in_order(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (Ptr<BigObject>& p : v1) {
+            sumU += sum_fields(*(p.operator->()));
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void shuffle_ptrs(std::vector<Ptr<BigObject>>& v) {
+    std::vector<unsigned int> order = shuffled_order(v.size());
+
+    for (size_t i = 0; i < v.size(); ++i) {
+        std::swap(v[i], v[order[i]]);
+    }
+}
+
+void bench_iterate_ptrs_shuffled(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+    shuffle_ptrs(v1);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (Ptr<BigObject>& p : v1) {
+            sumU += sum_fields(*(p.operator->()));
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void bench_iterate_ptrs_shuffled_after_reorder(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+    shuffle_ptrs(v1);
+    c1.reorderBy(v1);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (Ptr<BigObject>& p : v1) {
+            sumU += sum_fields(*(p.operator->()));
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void bench_iterate_handles_shuffled(State& state) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    std::mt19937 rng(1234U);
+    std::shuffle(v1.begin(), v1.end(), rng);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (Handle<BigObject> h : v1) {
+            sumU += sum_fields(*(c1.get(h)));
+        }
+
+        do_not_optimize(sumU);
+    }
+}
+
+void bench_reorder_by_ptrs(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        state.pause();
+        shuffle_ptrs(v1);
+        state.resume();
+
+        c1.reorderBy(v1);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void bench_iterate_for_each(State& state) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        c1.forEach([&sumU](const BigObject& obj) {
+            sumU += sum_fields(obj);
+        });
+
+        do_not_optimize(sumU);
+    }
+}
+
+void run_parallel_for_each(State& state, unsigned int threadCount) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    ThreadPool pool(threadCount);
+
+    while (state.next()) {
+        c1.parallelForEach(pool, [](BigObject& obj) {
+            for (unsigned int j = 0; j < 10U; ++j) {
+                obj.fValue[j] = obj.fValue[j] * 0.5f + 0.5f;
+                obj.uValue[j] = obj.uValue[j] * 3U + 1U;
+            }
+        });
+    }
+
+    do_not_optimize(c1.getObjects()[0].uValue[0]);
+}
+
+void bench_iterate_aos_float_sum(State& state) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        float sumF = 0.0f;
+
+        c1.forEach([&sumF](const BigObject& obj) {
+            for (unsigned int j = 0; j < 10U; ++j) {
+                sumF += obj.fValue[j];
+            }
+        });
+
+        do_not_optimize(sumF);
+    }
+}
+
+void bench_iterate_soa_float_sum(State& state) {
+    SoAContainer<std::array<float, 10>, std::array<unsigned int, 10>> c1;
+
+    std::array<float, 10> f;
+    std::array<unsigned int, 10> u;
+    f.fill(1.0f);
+    u.fill(1U);
+
+    for (size_t i = 0; i < state.size(); ++i) {
+        c1.make(f, u);
+    }
+
+    while (state.next()) {
+        float sumF = 0.0f;
+
+        const std::array<float, 10>* fColumn = c1.column<0>();
+        for (size_t i = 0; i < c1.size(); ++i) {
+            for (unsigned int j = 0; j < 10U; ++j) {
+                sumF += fColumn[i][j];
+            }
+        }
+
+        do_not_optimize(sumF);
+    }
+}
+
+void bench_iterate_components_by_handle(State& state) {
+    Container<Position> c1;
+    Container<Velocity> c2;
+    std::vector<std::pair<Handle<Position>, Handle<Velocity>>> v1;
+
+    for (size_t i = 0; i < state.size(); ++i) {
+        v1.emplace_back(c1.makeHandle(0.0f, 0.0f), c2.makeHandle(1.0f, 2.0f));
+    }
+
+    std::mt19937 rng(1234U);
+    std::shuffle(v1.begin(), v1.end(), rng);
+
+    while (state.next()) {
+        for (const std::pair<Handle<Position>, Handle<Velocity>>& entity : v1) {
+            Position* p = c1.get(entity.first);
+            const Velocity* v = c2.get(entity.second);
+            p->x += v->x;
+            p->y += v->y;
+        }
+    }
+
+    do_not_optimize(c1.getObjects()[0].y);
+}
+
+void bench_iterate_archetype(State& state) {
+    Archetype<Position, Velocity> c1;
+
+    for (size_t i = 0; i < state.size(); ++i) {
+        c1.make(Position(0.0f, 0.0f), Velocity(1.0f, 2.0f));
+    }
+
+    while (state.next()) {
+        c1.forEach<Position, Velocity>([](Position& p, const Velocity& v) {
+            p.x += v.x;
+            p.y += v.y;
+        });
+    }
+
+    do_not_optimize(c1.column<Position>()[0].y);
+}
+
+// One object in a hundred is changed between two passes.
+void run_changed_objects(State& state, bool dirtyOnly) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+    c1.enableDirtyTracking();
+    c1.clearDirty();
+
+    for (size_t i = 0; i < v1.size(); i += 100U) {
+        c1.get(v1[i])->uValue[0] = 2U;
+    }
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        if (dirtyOnly) {
+            c1.forEachDirty([&sumU](BigObject& obj) {
+                sumU += obj.uValue[0];
+            });
+        } else {
+            c1.forEach([&sumU](const BigObject& obj) {
+                if (obj.uValue[0] == 2U) {
+                    sumU += obj.uValue[0];
+                }
+            });
+        }
+
+        do_not_optimize(sumU);
+    }
+}
+
+void bench_iterate_changed_with_scan(State& state) {
+    run_changed_objects(state, false);
+}
+
+void bench_iterate_changed_with_dirty_bits(State& state) {
+    run_changed_objects(state, true);
+}
+
+void bench_borrow_ptr_copies(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (const Ptr<BigObject>& p1 : v1) {
+            Ptr<BigObject> p2 = p1;
+            sumU += p2->uValue[0];
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void bench_borrow_refs(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (const Ptr<BigObject>& p1 : v1) {
+            Ref<BigObject> r(p1);
+            sumU += r->uValue[0];
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void run_registry_lookup(State& state, bool throughRegistry) {
+    std::vector<Handle<BigObject>> v1;
+    containerFor<BigObject>().makeN(v1, 1000U, 1.0f, 1U);
+
+    Container<BigObject>& c1 = containerFor<BigObject>();
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (size_t i = 0; i < state.size(); ++i) {
+            Container<BigObject>& c = throughRegistry ? containerFor<BigObject>() : c1;
+            sumU += c.get(v1[i % 1000U])->uValue[0];
+        }
+
+        do_not_optimize(sumU);
+    }
+
+    containerFor<BigObject>().destroy(v1);
+}
+
+void bench_lookup_container_for(State& state) {
+    run_registry_lookup(state, true);
+}
+
+void bench_lookup_container_reference(State& state) {
+    run_registry_lookup(state, false);
+}
+
+void fill_keyed_objects(Container<BigObject>& c, size_t count, std::vector<unsigned int>& keys, size_t lookups) {
+    for (size_t i = 0; i < count; ++i) {
+        c.makeHandle(1.0f, static_cast<unsigned int>(i * 7U));
+    }
+
+    std::mt19937 rng(1234U);
+    keys.resize(lookups);
+    for (size_t i = 0; i < lookups; ++i) {
+        keys[i] = static_cast<unsigned int>(rng() % count) * 7U;
+    }
+}
+
+void bench_lookup_key_with_scan(State& state) {
+    Container<BigObject> c1;
+    std::vector<unsigned int> keys;
+    fill_keyed_objects(c1, state.size(), keys, 100U);
+    state.setItems(keys.size());
+
+    const Container<BigObject>::Storage& objects = c1.getObjects();
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (unsigned int key : keys) {
+            for (size_t i = 0; i < objects.size(); ++i) {
+                if (objects[i].uValue[0] == key) {
+                    sumU += c1.getObjectSlots()[i];
+                    break;
+                }
+            }
+        }
+
+        do_not_optimize(sumU);
+    }
+}
+
+template<class Index>
+void run_index_lookup(State& state) {
+    Container<BigObject> c1;
+    std::vector<unsigned int> keys;
+    fill_keyed_objects(c1, state.size(), keys, 10000U);
+    state.setItems(keys.size());
+
+    Index index(c1);
+
+    while (state.next()) {
+        unsigned int sumU = 0U;
+
+        for (unsigned int key : keys) {
+            sumU += index.find(key).getIndex();
+        }
+
+        do_not_optimize(sumU);
+    }
+}
+
+void bench_lookup_key_with_hash_index(State& state) {
+    run_index_lookup<HashIndex<BigObject, unsigned int, BigObjectKey>>(state);
+}
+
+void bench_lookup_key_with_sorted_index(State& state) {
+    run_index_lookup<SortedIndex<BigObject, unsigned int, BigObjectKey>>(state);
+}
+
+void fill_random_values(Container<BigObject>& c, size_t count) {
+    std::mt19937 rng(1234U);
+
+    for (size_t i = 0; i < count; ++i) {
+        c.makeHandle(1.0f, static_cast<unsigned int>(rng() % 1000U));
+    }
+}
+
+void bench_query_ptr_loop(State& state) {
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    std::mt19937 rng(1234U);
+    for (Ptr<BigObject>& p : v1) {
+        p->uValue[0] = rng() % 1000U;
+    }
+
+    while (state.next()) {
+        size_t matches = 0;
+
+        for (Ptr<BigObject>& p : v1) {
+            if (p->uValue[0] > 900U) {
+                matches++;
+            }
+        }
+
+        do_not_optimize(matches);
+    }
+
+    release_ptrs(c1, v1);
+}
+
+void run_query_count_if(State& state, QueryKernel kernel) {
+    Container<BigObject> c1;
+    fill_random_values(c1, state.size());
+
+    Where<unsigned int> where(offsetof(BigObject, uValue), kGreater, 900U);
+
+    QueryKernel best = getQueryKernel();
+    setQueryKernel(kernel);
+
+    while (state.next()) {
+        size_t matches = countIf(c1, where);
+        do_not_optimize(matches);
+    }
+
+    setQueryKernel(best);
+}
+
+void bench_query_filter(State& state) {
+    Container<BigObject> c1;
+    fill_random_values(c1, state.size());
+
+    Where<unsigned int> where(offsetof(BigObject, uValue), kGreater, 900U);
+    std::vector<unsigned int> positions;
+    positions.reserve(state.size());
+
+    while (state.next()) {
+        positions.clear();
+        filter(c1, where, positions);
+        do_not_optimize(positions.data());
+    }
+}
+
+const char* kSnapshotPath = "cmc_bench_snapshot.bin";
+
+void bench_snapshot_rebuild_with_make_n(State& state) {
+    while (state.next()) {
+        Container<BigObject> c1;
+        std::vector<Handle<BigObject>> v1;
+        c1.makeN(v1, state.size(), 1.0f, 1U);
+
+        state.pause();
+    }
+}
+
+void bench_snapshot_save(State& state) {
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, state.size(), 1.0f, 1U);
+
+    while (state.next()) {
+        c1.save(kSnapshotPath);
+    }
+
+    std::remove(kSnapshotPath);
+}
+
+void bench_snapshot_load(State& state) {
+    {
+        Container<BigObject> c1;
+        std::vector<Handle<BigObject>> v1;
+        c1.makeN(v1, state.size(), 1.0f, 1U);
+        c1.save(kSnapshotPath);
+    }
+
+    while (state.next()) {
+        Container<BigObject> c2;
+        c2.load(kSnapshotPath);
+
+        state.pause();
+    }
+
+    std::remove(kSnapshotPath);
+}
+
+std::vector<Scenario> make_scenarios() {
+    std::vector<Scenario> scenarios = {
+        {"create/new_and_vector", bench_create_new_and_vector},
+        {"create/make", bench_create_make},
+        {"create/make_n", bench_create_make_n},
+        {"create/make_handle", bench_create_make_handle},
+        {"create/make_handle_fixed_capacity", bench_create_make_handle_fixed_capacity},
+        {"create/make_handle_paged", bench_create_make_handle_paged},
+        {"copy/ptrs", bench_copy_ptrs},
+        {"copy/handles", bench_copy_handles},
+        {"destroy/random_ptrs", bench_destroy_random_ptrs},
+        {"destroy/random_ptrs_holding_ptrs", bench_destroy_random_ptrs_holding_ptrs},
+        {"destroy/random_ptrs_deferred_drop", bench_destroy_random_ptrs_deferred_drop},
+        {"destroy/random_ptrs_deferred_with_collect", bench_destroy_random_ptrs_deferred_with_collect},
+        {"destroy/ptrs_in_order", bench_destroy_ptrs_in_order},
+        {"destroy/ptrs_in_bulk", bench_destroy_ptrs_in_bulk},
+        {"destroy/clear", bench_destroy_clear},
+        {"iterate/new_scattered", bench_iterate_new_scattered},
+        {"iterate/ptrs_in_order", bench_iterate_ptrs_in_order},
+        {"iterate/ptrs_shuffled", bench_iterate_ptrs_shuffled},
+        {"iterate/ptrs_shuffled_after_reorder", bench_iterate_ptrs_shuffled_after_reorder},
+        {"iterate/handles_shuffled", bench_iterate_handles_shuffled},
+        {"iterate/for_each", bench_iterate_for_each}
+    };
+
+    for (unsigned int threadCount : {1U, 2U, 4U, 8U}) {
+        scenarios.push_back({"iterate/parallel_for_each_" + std::to_string(threadCount) + "t", [threadCount](State& state) {
+            run_parallel_for_each(state, threadCount);
+        }});
+    }
+
+    scenarios.insert(scenarios.end(), {
+        {"iterate/aos_float_sum", bench_iterate_aos_float_sum},
+        {"iterate/soa_float_sum", bench_iterate_soa_float_sum},
+        {"iterate/components_by_handle", bench_iterate_components_by_handle},
+        {"iterate/archetype", bench_iterate_archetype},
+        {"iterate/changed_with_scan", bench_iterate_changed_with_scan},
+        {"iterate/changed_with_dirty_bits", bench_iterate_changed_with_dirty_bits},
+        {"reorder/by_ptrs", bench_reorder_by_ptrs},
+        {"borrow/ptr_copies", bench_borrow_ptr_copies},
+        {"borrow/refs", bench_borrow_refs},
+        {"lookup/container_for", bench_lookup_container_for},
+        {"lookup/container_reference", bench_lookup_container_reference},
+        {"lookup/key_with_scan", bench_lookup_key_with_scan},
+        {"lookup/key_with_hash_index", bench_lookup_key_with_hash_index},
+        {"lookup/key_with_sorted_index", bench_lookup_key_with_sorted_index},
+        {"query/ptr_loop", bench_query_ptr_loop}
+    });
+
+    // Only the kernels this CPU supports.
+    const char* kernelNames[] = {"scalar", "sse2", "avx2"};
+
+    for (int kernel = kScalarKernel; kernel <= getQueryKernel(); ++kernel) {
+        QueryKernel queryKernel = static_cast<QueryKernel>(kernel);
+
+        scenarios.push_back({std::string("query/count_if_") + kernelNames[kernel], [queryKernel](State& state) {
+            run_query_count_if(state, queryKernel);
+        }});
+    }
+
+    scenarios.insert(scenarios.end(), {
+        {"query/filter", bench_query_filter},
+        {"snapshot/rebuild_with_make_n", bench_snapshot_rebuild_with_make_n},
+        {"snapshot/save", bench_snapshot_save},
+        {"snapshot/load", bench_snapshot_load}
+    });
+
+    return scenarios;
+}
+
+Result summarize(const std::string& name, const State& state) {
+    std::vector<double> samples = state.getSamples();
+    std::sort(samples.begin(), samples.end());
+
+    size_t count = samples.size();
+
+    Result result;
+    result.name = name;
+    result.size = state.size();
+    result.items = state.getItems();
+    result.repeats = count;
+    result.median = (count % 2 == 1) ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+    result.p99 = samples[static_cast<size_t>(std::ceil(0.99 * static_cast<double>(count))) - 1];
+    result.min = samples[0];
+
+    double total = 0.0;
+    for (double sample : samples) {
+        total += sample;
+    }
+
+    result.mean = total / static_cast<double>(count);
+
+    return result;
+}
+
+double ns_per_item(const Result& result) {
+    return (result.items == 0) ? 0.0 : result.median * 1e9 / static_cast<double>(result.items);
+}
+
+enum Format {
+    kText,
+    kCsv,
+    kJson
+};
+
+void print_header(Format format) {
+    if (format == kText) {
+        printf("%-44s %10s %12s %12s %12s %10s\n", "scenario", "size", "median ms", "p99 ms", "min ms", "ns/item");
+    } else if (format == kCsv) {
+        printf("scenario,size,items,repeats,median_s,p99_s,min_s,mean_s,ns_per_item\n");
+    } else {
+        printf("[\n");
+    }
+}
+
+void print_result(Format format, const Result& r, bool first) {
+    if (format == kText) {
+        printf("%-44s %10zu %12.3f %12.3f %12.3f %10.2f\n", r.name.c_str(), r.size, r.median * 1e3, r.p99 * 1e3, r.min * 1e3, ns_per_item(r));
+    } else if (format == kCsv) {
+        printf("%s,%zu,%zu,%zu,%.9f,%.9f,%.9f,%.9f,%.3f\n", r.name.c_str(), r.size, r.items, r.repeats, r.median, r.p99, r.min, r.mean, ns_per_item(r));
+    } else {
+        printf("%s  {\"scenario\": \"%s\", \"size\": %zu, \"items\": %zu, \"repeats\": %zu, \"median_s\": %.9f, \"p99_s\": %.9f, \"min_s\": %.9f, \"mean_s\": %.9f, \"ns_per_item\": %.3f}",
+               first ? "" : ",\n", r.name.c_str(), r.size, r.items, r.repeats, r.median, r.p99, r.min, r.mean, ns_per_item(r));
+    }
+
+    fflush(stdout);
+}
+
+void print_footer(Format format) {
+    if (format == kJson) {
+        printf("\n]\n");
+    }
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--sizes=N,N,...] [--warmup=N] [--repeats=N] [--format=text|csv|json] [--filter=TEXT] [--list]\n"
+            "  --sizes    object counts to run every scenario with (default 10000,100000,1000000)\n"
+            "  --warmup   runs discarded before measuring (default 1)\n"
+            "  --repeats  measured runs per scenario and size (default 10)\n"
+            "  --format   output format (default text)\n"
+            "  --filter   only run the scenarios whose name contains TEXT\n"
+            "  --list     print the scenario names and exit\n",
+            program);
+}
+
+bool parse_count(const char* text, size_t& value) {
+    char* end = nullptr;
+    unsigned long long parsed = std::strtoull(text, &end, 10);
+
+    if ((end == text) || (parsed == 0)) {
+        return false;
+    }
+
+    value = static_cast<size_t>(parsed);
+    return (*end == '\0') || (*end == ',');
+}
+
+bool parse_sizes(const char* text, std::vector<size_t>& sizes) {
+    sizes.clear();
+
+    while (true) {
+        size_t size = 0;
+        if (!parse_count(text, size)) {
+            return false;
+        }
+
+        sizes.push_back(size);
+
+        text = std::strchr(text, ',');
+        if (text == nullptr) {
+            return true;
+        }
+
+        text++;
+    }
+}
+
+bool starts_with(const char* text, const char* prefix, const char*& rest) {
+    size_t length = std::strlen(prefix);
+
+    if (std::strncmp(text, prefix, length) != 0) {
+        return false;
+    }
+
+    rest = text + length;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes = {10000U, 100000U, 1000000U};
+    size_t warmup = 1;
+    size_t repeats = 10;
+    Format format = kText;
+    std::string filter;
+    bool list = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* value = nullptr;
+        bool valid = true;
+
+        if (starts_with(argv[i], "--sizes=", value)) {
+            valid = parse_sizes(value, sizes);
+        } else if (starts_with(argv[i], "--warmup=", value)) {
+            char* end = nullptr;
+            warmup = static_cast<size_t>(std::strtoull(value, &end, 10));
+            valid = (end != value) && (*end == '\0');
+        } else if (starts_with(argv[i], "--repeats=", value)) {
+            valid = parse_count(value, repeats) && (std::strchr(value, ',') == nullptr);
+        } else if (starts_with(argv[i], "--format=", value)) {
+            if (std::strcmp(value, "text") == 0) {
+                format = kText;
+            } else if (std::strcmp(value, "csv") == 0) {
+                format = kCsv;
+            } else if (std::strcmp(value, "json") == 0) {
+                format = kJson;
+            } else {
+                valid = false;
+            }
+        } else if (starts_with(argv[i], "--filter=", value)) {
+            filter = value;
+        } else if (std::strcmp(argv[i], "--list") == 0) {
+            list = true;
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Scenario> scenarios = make_scenarios();
+
+    if (list) {
+        for (const Scenario& scenario : scenarios) {
+            printf("%s\n", scenario.name.c_str());
+        }
+
+        return 0;
+    }
+
+    print_header(format);
+
+    bool first = true;
+
+    for (const Scenario& scenario : scenarios) {
+        if (scenario.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        for (size_t size : sizes) {
+            State state(size, static_cast<unsigned int>(warmup), static_cast<unsigned int>(repeats));
+            scenario.run(state);
+
+            print_result(format, summarize(scenario.name, state), first);
+            first = false;
+        }
+    }
+
+    print_footer(format);
+
+    return 0;
+}
@@ -1,54 +1,102 @@
+#include "CompactPtr.h"
+#include "ConcurrentContainer.h"
 #include "Container.h"
+#include "Handle.h"
+#include "Index.h"
+#include "Journal.h"
+#include "MemoryResource.h"
 #include "Ptr.h"
-
+#include "Query.h"
+#include "Ref.h"
+#include "Registry.h"
+#include "SoAContainer.h"
+#include "Storage.h"
+#include "TestObjects.h"
+#include "ThreadPool.h"
+#include "WeakPtr.h"
+
+#include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
 
 using namespace cmc;
 
-class BigObject final {
+class ObjWithRefSameType final {
 public:
-    BigObject() = delete;
-    explicit BigObject(float f, unsigned int u)
-    : fValue{f, f, f, f, f, f, f, f, f, f}
-    , uValue{u, u, u, u, u, u, u, u, u, u}
+    ObjWithRefSameType() = delete;
+    explicit ObjWithRefSameType(float f, const std::vector<Ptr<ObjWithRefSameType>> v)
+    : fValue(f)
+    , vPtr(v)
     {}
 
-    template<typename A, typename B> BigObject(A, B) = delete;
+    template<typename A, typename B> ObjWithRefSameType(A, B) = delete;
 
-    float fValue[10];
-    unsigned int uValue[10];
+    float fValue;
+    std::vector<Ptr<ObjWithRefSameType>> vPtr;
 };
 
-class ObjWithRef final {
+class ObjWithCompactRef final {
 public:
-    ObjWithRef() = delete;
-    explicit ObjWithRef(float f, const Ptr<BigObject> ptr)
+    ObjWithCompactRef() = delete;
+    explicit ObjWithCompactRef(float f, const CompactPtr<BigObject> ptr)
     : fValue(f)
     , ptrBO(ptr)
     {}
 
-    template<typename A, typename B> ObjWithRef(A, B) = delete;
+    template<typename A, typename B> ObjWithCompactRef(A, B) = delete;
 
     float fValue;
-    Ptr<BigObject> ptrBO;
+    CompactPtr<BigObject> ptrBO;
 };
 
-class ObjWithRefSameType final {
+class ObjWithCompactRefSameType final {
 public:
-    ObjWithRefSameType() = delete;
-    explicit ObjWithRefSameType(float f, const std::vector<Ptr<ObjWithRefSameType>> v)
+    ObjWithCompactRefSameType() = delete;
+    explicit ObjWithCompactRefSameType(float f, const CompactPtr<ObjWithCompactRefSameType> ptr)
     : fValue(f)
-    , vPtr(v)
+    , ptrSame(ptr)
     {}
 
-    template<typename A, typename B> ObjWithRefSameType(A, B) = delete;
+    template<typename A, typename B> ObjWithCompactRefSameType(A, B) = delete;
 
     float fValue;
-    std::vector<Ptr<ObjWithRefSameType>> vPtr;
+    CompactPtr<ObjWithCompactRefSameType> ptrSame;
+};
+
+class ObjWithHandle final {
+public:
+    ObjWithHandle() = delete;
+    explicit ObjWithHandle(float f, Handle<BigObject> handle)
+    : fValue(f)
+    , handleBO(handle)
+    {}
+
+    template<typename A, typename B> ObjWithHandle(A, B) = delete;
+
+    float fValue;
+    Handle<BigObject> handleBO;
+};
+
+namespace cmc {
+
+template<>
+struct CycleTraits<ObjWithRefSameType> {
+    template<typename F>
+    static void forEachPtr(ObjWithRefSameType& obj, F f) {
+        for (Ptr<ObjWithRefSameType>& p : obj.vPtr) {
+            f(p);
+        }
+    }
 };
 
+}
+
 void test_create_two_elements() {
     Container<BigObject> c;
 
@@ -350,285 +398,1877 @@ void test_create_ptr_of_object_and_add_it_to_vector() {
     assert(c.getPtrOffsets().size() == 0);
 }
 
-void test_two_objects_within_circular_reference_still_leak() {
-    Container<ObjWithRefSameType> c;
+void test_remove_first_element_moves_last_one_into_its_slot() {
+    Container<BigObject> c;
 
     {
-        Ptr<ObjWithRefSameType> cp1 = c.make(1.0f, std::vector<Ptr<ObjWithRefSameType>>());
-        Ptr<ObjWithRefSameType> cp2 = c.make(1.0f, std::vector<Ptr<ObjWithRefSameType>>({cp1}));
-        cp1->vPtr.push_back(cp2);
+        Ptr<BigObject> cp3 = c.make(3.0f, 3U);
+
+        {
+            Ptr<BigObject> cp1 = c.make(1.0f, 1U);
+            Ptr<BigObject> cp2 = c.make(2.0f, 2U);
+            Ptr<BigObject> cp2b = cp2;
+
+            cp3 = cp1;
+
+            assert(c.getObjects().size() == 2);
+            assert(c.getObjects()[0].uValue[0] == 2U);
+            assert(c.getObjects()[1].uValue[0] == 1U);
+
+            assert(c.getRefCounts()[0] == 2);
+            assert(c.getRefCounts()[1] == 2);
+
+            assert(c.getObjectSlots()[0] == 2);
+            assert(c.getObjectSlots()[1] == 1);
+
+            assert(c.getSlotOffsets()[1] == 1);
+            assert(c.getSlotOffsets()[2] == 0);
+
+            assert(cp1->uValue[0] == 1U);
+            assert(cp2->uValue[0] == 2U);
+            assert(cp2b->uValue[0] == 2U);
+            assert(cp3->uValue[0] == 1U);
+        }
+
+        assert(c.getObjects().size() == 1);
+        assert(cp3->uValue[0] == 1U);
+
+        Ptr<BigObject> cp4 = c.make(4.0f, 4U);
 
         assert(c.getObjects().size() == 2);
-        assert(c.getRefCounts().size() == 2);
-        assert(c.getPtrAddresses().size() == 4);
-        assert(c.getPtrOffsets().size() == 4);
+        assert(c.getObjectSlots()[1] == 2);
+        assert(cp4->uValue[0] == 4U);
+        assert(cp3->uValue[0] == 1U);
     }
 
-    assert(c.getObjects().size() == 2);
-    assert(c.getRefCounts().size() == 2);
-    assert(c.getPtrAddresses().size() == 2);
-    assert(c.getPtrOffsets().size() == 2);
+    assert(c.getObjects().size() == 0);
+    assert(c.getRefCounts().size() == 0);
+    assert(c.getObjectSlots().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+    assert(c.getPtrOffsets().size() == 0);
 }
 
-void test_performance_many_creations_with_regular_vector_and_pointers() {
-    unsigned int count = 200000;
+void test_handles_detect_reused_slots_with_generation() {
+    Container<BigObject> c;
 
-    auto t1 = std::chrono::steady_clock::now();
+    Handle<BigObject> h1 = c.makeHandle(1.0f, 1U);
+    Handle<BigObject> h2 = c.makeHandle(2.0f, 2U);
+    Handle<BigObject> h2b = h2;
 
-    std::vector<BigObject*> v1;
+    assert(h1 != h2);
+    assert(h2 == h2b);
 
-    auto t2 = std::chrono::steady_clock::now();
+    assert(c.getObjects().size() == 2);
+    assert(c.getPtrAddresses().size() == 0);
+    assert(c.getPtrOffsets().size() == 0);
+    assert(c.getRefCounts()[0] == 1);
+    assert(c.getRefCounts()[1] == 1);
 
-    for (unsigned int i = 0; i < count; ++i) {
-        BigObject* p = new BigObject(1.0f, 1U);
-        v1.emplace_back(p);
-    }
+    assert(c.get(h1)->uValue[0] == 1U);
+    assert(c.get(h2b)->uValue[0] == 2U);
 
-    auto t3 = std::chrono::steady_clock::now();
+    c.destroy(h1);
 
-    for (unsigned int i = 0; i < count; ++i) {
-        delete v1[i];
-    }
+    assert(c.getObjects().size() == 1);
+    assert(!c.isValid(h1));
+    assert(c.get(h1) == nullptr);
+    assert(c.get(h2)->uValue[0] == 2U);
 
-    auto t4 = std::chrono::steady_clock::now();
+    c.destroy(h1);
 
-    v1.clear();
+    assert(c.getObjects().size() == 1);
 
-    auto t5 = std::chrono::steady_clock::now();
+    Handle<BigObject> h3 = c.makeHandle(3.0f, 3U);
 
-    printf("\n");
-    printf("  -- construction: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count());
-    printf("  -- filling: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t3 - t2).count());
-    printf("  -- destroy objects: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t4 - t3).count());
-    printf("  -- destroy vec: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t5 - t4).count());
-}
+    assert(h3.getIndex() == h1.getIndex());
+    assert(h3.getGeneration() == h1.getGeneration() + 1);
+    assert(c.get(h1) == nullptr);
+    assert(c.get(h3)->uValue[0] == 3U);
 
-void test_performance_many_creations_with_experimental_container() {
-    unsigned int count = 200000;
+    Handle<BigObject> hInvalid;
 
-    auto t1 = std::chrono::steady_clock::now();
+    assert(!c.isValid(hInvalid));
 
-    Container<BigObject> c2;
-    std::vector<Ptr<BigObject>> v2;
+    c.destroy(h2);
+    c.destroy(h3);
+
+    assert(c.getObjects().size() == 0);
+    assert(c.getRefCounts().size() == 0);
+    assert(c.getObjectSlots().size() == 0);
+}
+
+void test_destroying_a_handle_referenced_by_a_ptr_throws() {
+    Container<BigObject> c;
 
-    auto t2 = std::chrono::steady_clock::now();
+    Handle<BigObject> h1 = c.makeHandle(1.0f, 1U);
+    Handle<BigObject> h2 = c.makeHandle(2.0f, 2U);
 
-    for (unsigned int i = 0; i < count; ++i) {
-        Ptr<BigObject> p = c2.make(2.0f, 2U);
-        v2.emplace_back(p);
+    {
+        Ptr<BigObject> cp1 = WeakPtr<BigObject>(&c, h1).lock();
+        assert(c.getRefCounts()[0] == 2U);
+
+        bool thrown = false;
+        try {
+            c.destroy(h1);
+        } catch (const std::logic_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        c.destroy(h2);
+        assert(c.size() == 1);
+        assert(c.isValid(h1));
+        assert(cp1->uValue[0] == 1U);
     }
 
-    auto t3 = std::chrono::steady_clock::now();
+    assert(c.getRefCounts()[0] == 1U);
 
-    c2.invalidatePtrs();
+    c.destroy(h1);
+    assert(!c.isValid(h1));
+    assert(c.size() == 0);
+}
 
-    auto t4 = std::chrono::steady_clock::now();
+void test_destroying_a_handle_found_through_an_index_throws() {
+    Container<BigObject> c;
+    HashIndex<BigObject, unsigned int, BigObjectKey> hashIndex(c);
 
-    v2.clear();
+    Ptr<BigObject> cp1 = c.make(1.0f, 42U);
+    Handle<BigObject> h2 = c.makeHandle(2.0f, 7U);
 
-    auto t5 = std::chrono::steady_clock::now();
+    bool thrown = false;
+    try {
+        c.destroy(hashIndex.find(42U));
+    } catch (const std::logic_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(c.size() == 2);
+    assert(cp1->uValue[0] == 42U);
+
+    c.forEachWithHandle([&c, &thrown](Handle<BigObject> handle, BigObject& obj) {
+        if (obj.uValue[0] == 42U) {
+            thrown = false;
+            try {
+                c.destroy(handle);
+            } catch (const std::logic_error&) {
+                thrown = true;
+            }
+        }
+    });
+    assert(thrown);
+    assert(cp1->uValue[0] == 42U);
 
-    printf("\n");
-    printf("  -- construction: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count());
-    printf("  -- filling: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t3 - t2).count());
-    printf("  -- destroy cont: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t4 - t3).count());
-    printf("  -- destroy vec: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t5 - t4).count());
+    c.destroy(hashIndex.find(7U));
+    assert(!c.isValid(h2));
+    assert(c.size() == 1);
 }
 
-void test_performance_compute_operations_with_non_linear_memory_with_regular_vector_and_pointers() {
-    unsigned int count = 200000;
-    unsigned int countObstruct = 100U;
+void test_dense_iteration_over_objects() {
+    Container<BigObject> c;
 
-    std::vector<BigObject*> v1;
-    std::vector<BigObject*> vObstruct;
+    {
+        Ptr<BigObject> cp1 = c.make(1.0f, 1U);
+        Handle<BigObject> h2 = c.makeHandle(2.0f, 2U);
+        Ptr<BigObject> cp3 = c.make(3.0f, 3U);
 
-    for (unsigned int i = 0; i < count; ++i) {
-        BigObject* p = new BigObject(1.0f, 1U);
-        v1.emplace_back(p);
+        assert(c.size() == 3);
+        assert(c.data() == &(*c.begin()));
+        assert(c.end() - c.begin() == 3);
 
-        for (unsigned int i = 0; i < countObstruct; ++i) {
-            BigObject* pO = new BigObject(1.0f, 1U);
-            vObstruct.emplace_back(pO);
+        unsigned int sumU = 0U;
+        for (const BigObject& obj : c) {
+            sumU += obj.uValue[0];
         }
+
+        assert(sumU == 6U);
+
+        c.forEach([](BigObject& obj) {
+            obj.uValue[0] *= 10U;
+        });
+
+        assert(cp1->uValue[0] == 10U);
+        assert(c.get(h2)->uValue[0] == 20U);
+        assert(cp3->uValue[0] == 30U);
+
+        c.destroy(h2);
+
+        std::vector<Handle<BigObject>> handles;
+        c.forEachWithHandle([&handles](Handle<BigObject> h, BigObject& obj) {
+            assert(obj.uValue[0] == 10U || obj.uValue[0] == 30U);
+            handles.emplace_back(h);
+        });
+
+        assert(handles.size() == 2);
+        assert(c.get(handles[0]) == cp1.operator->());
+        assert(c.get(handles[1]) == cp3.operator->());
     }
 
-    auto t1 = std::chrono::steady_clock::now();
+    assert(c.size() == 0);
+    assert(c.begin() == c.end());
+}
+
+void test_soa_container_compacts_all_columns() {
+    SoAContainer<float, unsigned int> c;
+    typedef SoAContainer<float, unsigned int>::HandleType H;
+
+    H h1 = c.make(1.0f, 1U);
+    H h2 = c.make(2.0f, 2U);
+    H h3 = c.make(3.0f, 3U);
+
+    assert(c.size() == 3);
+    assert(*c.get<0>(h2) == 2.0f);
+    assert(*c.get<1>(h2) == 2U);
+
+    c.destroy(h1);
+
+    assert(c.size() == 2);
+    assert(!c.isValid(h1));
+    assert(c.get<0>(h1) == nullptr);
+
+    assert(c.column<0>()[0] == 3.0f);
+    assert(c.column<1>()[0] == 3U);
+    assert(c.column<0>()[1] == 2.0f);
+    assert(c.column<1>()[1] == 2U);
+
+    assert(*c.get<0>(h3) == 3.0f);
+    assert(*c.get<1>(h3) == 3U);
+    assert(*c.get<1>(h2) == 2U);
+
+    c.destroy(h3);
+    c.destroy(h2);
+
+    assert(c.size() == 0);
+    assert(c.getObjectSlots().size() == 0);
+}
+
+void test_archetype_queries_components_in_lockstep() {
+    Archetype<Position, Velocity, unsigned int> c;
+    typedef Archetype<Position, Velocity, unsigned int>::HandleType H;
+
+    H h1 = c.make(Position(0.0f, 0.0f), Velocity(1.0f, 1.0f), 1U);
+    H h2 = c.make(Position(1.0f, 1.0f), Velocity(2.0f, 0.0f), 2U);
+    H h3 = c.make(Position(2.0f, 2.0f), Velocity(0.0f, 3.0f), 3U);
+
+    assert(c.get<Velocity>(h2)->x == 2.0f);
+    assert(c.get<Velocity>(h2) == c.get<1>(h2));
+    assert(*c.get<unsigned int>(h3) == 3U);
+
+    c.forEach<Position, Velocity>([](Position& p, const Velocity& v) {
+        p.x += v.x;
+        p.y += v.y;
+    });
+
+    c.destroy(h1);
+
+    assert(c.column<unsigned int>()[0] == 3U);
+    assert(c.get<Position>(h3)->x == 2.0f);
+    assert(c.get<Position>(h3)->y == 5.0f);
+    assert(c.get<Position>(h2)->x == 3.0f);
+    assert(c.get<Position>(h1) == nullptr);
 
     unsigned int sumU = 0U;
-    unsigned int mulU = 1U;
-    float sumF = 0.0f;
-    float mulF = 1.0f;
+    float sumX = 0.0f;
+    const Archetype<Position, Velocity, unsigned int>& cc = c;
+    cc.forEach<unsigned int, Position>([&](const unsigned int& u, const Position& p) {
+        sumU += u;
+        sumX += p.x;
+    });
+
+    assert(sumU == 5U);
+    assert(sumX == 5.0f);
+}
 
-    for (unsigned int k = 0; k < 10U; ++k) {
-        for (unsigned int i = 0; i < count; ++i) {
-            for (unsigned int j = 0; j < 10U; ++j) {
-                sumU += v1[i]->uValue[j];
-                mulU *= v1[i]->uValue[j];
+void test_compaction_moves_objects_holding_ptrs() {
+    Container<ObjWithRefSameType> c;
 
-                sumF += v1[i]->fValue[j];
-                mulF *= v1[i]->fValue[j];
-            }
-        }
-    }
+    {
+        Ptr<ObjWithRefSameType> cp1 = c.make(1.0f, std::vector<Ptr<ObjWithRefSameType>>());
+        Ptr<ObjWithRefSameType> cp2 = c.make(2.0f, std::vector<Ptr<ObjWithRefSameType>>());
+        Ptr<ObjWithRefSameType> cp3 = c.make(3.0f, std::vector<Ptr<ObjWithRefSameType>>({cp2, cp2}));
+
+        assert(c.getPtrAddresses().size() == 5);
 
-    auto t2 = std::chrono::steady_clock::now();
+        Ptr<ObjWithRefSameType>* nested = &(cp3->vPtr[0]);
 
+        cp1 = cp3;
 
-    unsigned int total = count * countObstruct;
-    for (unsigned int i = 0; i < total; ++i) {
-        delete vObstruct[i];
+        assert(c.getObjects().size() == 2);
+        assert(c.getPtrAddresses().size() == 5);
+        assert(c.getRefCounts()[0] == 2);
+        assert(c.getRefCounts()[1] == 3);
+
+        assert(cp1->fValue == 3.0f);
+        assert(&(cp1->vPtr[0]) == nested);
+        assert(cp1->vPtr[1] == cp2);
     }
 
-    vObstruct.clear();
+    assert(c.getObjects().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+    assert(c.getPtrOffsets().size() == 0);
+}
 
-    for (unsigned int i = 0; i < count; ++i) {
-        delete v1[i];
+void test_move_and_cross_container_assignment() {
+    Container<BigObject> c1;
+    Container<BigObject> c2;
+
+    {
+        Ptr<BigObject> cp1 = c1.make(1.0f, 1U);
+        Ptr<BigObject> cp2 = c2.make(2.0f, 2U);
+        Ptr<BigObject> cp3 = c1.make(3.0f, 3U);
+
+        cp1 = cp2;
+
+        assert(cp1 == cp2);
+        assert(c1.getObjects().size() == 1);
+        assert(c1.getPtrAddresses().size() == 1);
+        assert(c2.getRefCounts()[0] == 2);
+        assert(c2.getPtrAddresses().size() == 2);
+
+        cp2 = std::move(cp3);
+
+        assert(cp2->uValue[0] == 3U);
+        assert(c1.getPtrAddresses().size() == 1);
+        assert(c1.getPtrAddresses()[0] == &cp2);
+        assert(c2.getRefCounts()[0] == 1);
+        assert(c2.getPtrAddresses().size() == 1);
+
+        cp3 = cp1;
+
+        assert(cp3->uValue[0] == 2U);
+        assert(c2.getRefCounts()[0] == 2);
+
+        cp1 = cp1;
+
+        assert(cp1->uValue[0] == 2U);
+        assert(c2.getRefCounts()[0] == 2);
     }
 
-    v1.clear();
+    assert(c1.getObjects().size() == 0);
+    assert(c1.getPtrAddresses().size() == 0);
+    assert(c2.getObjects().size() == 0);
+    assert(c2.getPtrAddresses().size() == 0);
+}
+
+void test_bulk_creation_of_ptrs_and_handles() {
+    Container<BigObject> c;
+
+    {
+        std::vector<Ptr<BigObject>> v1;
+        Ptr<BigObject> cp1 = c.make(1.0f, 1U);
+
+        c.makeN(v1, 3, 2.0f, 2U);
+
+        assert(v1.size() == 3);
+        assert(c.getObjects().size() == 4);
+        assert(c.getPtrAddresses().size() == 4);
+        assert(c.getPtrAddresses()[1] == &(v1[0]));
+        assert(c.getPtrAddresses()[3] == &(v1[2]));
+        assert(c.getRefCounts()[3] == 1);
+        assert(v1[2]->uValue[0] == 2U);
+
+        std::vector<unsigned int> values = {5U, 6U};
+        c.makeFrom(values.begin(), values.end(), [](unsigned int u) {
+            return BigObject(static_cast<float>(u), u);
+        }, v1);
+
+        assert(v1.size() == 5);
+        assert(c.getObjects().size() == 6);
+        assert(c.getPtrAddresses().size() == 6);
+        assert(c.getPtrAddresses()[5] == &(v1[4]));
+        assert(v1[3]->uValue[0] == 5U);
+        assert(v1[4]->fValue[0] == 6.0f);
+
+        std::vector<Handle<BigObject>> h1;
+        c.makeN(h1, 2, 7.0f, 7U);
+
+        assert(h1.size() == 2);
+        assert(c.getObjects().size() == 8);
+        assert(c.get(h1[1])->uValue[0] == 7U);
+
+        c.destroy(h1[0]);
+        c.destroy(h1[1]);
+    }
 
-    printf("\n");
-    printf("  -- sumF: %f, mulF: %f\n", (double)sumF, (double)mulF);
-    printf("  -- sumU: %d, mulU: %d\n", sumU, mulU);
-    printf("  -- execution: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count());
+    assert(c.getObjects().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+    assert(c.getPtrOffsets().size() == 0);
 }
 
-void test_performance_compute_operations_with_linear_memory_with_experimental_container() {
-    unsigned int count = 200000;
-    unsigned int countObstruct = 100U;
+void test_bulk_destruction_and_clear() {
+    Container<BigObject> c;
 
-    Container<BigObject> c1;
-    std::vector<Ptr<BigObject>> v1;
+    {
+        std::vector<Ptr<BigObject>> v1;
+        std::vector<Ptr<BigObject>> v2;
 
-    std::vector<BigObject*> vObstruct;
+        c.makeN(v1, 4, 1.0f, 1U);
+        c.makeN(v2, 2, 2.0f, 2U);
 
-    for (unsigned int i = 0; i < count; ++i) {
-        Ptr<BigObject> p = c1.make(1.0f, 1U);
-        v1.emplace_back(p);
+        Ptr<BigObject> cp1 = v1[1];
+        Ptr<BigObject> cp2 = v2[0];
 
-        for (unsigned int i = 0; i < countObstruct; ++i) {
-            BigObject* pO = new BigObject(1.0f, 1U);
-            vObstruct.emplace_back(pO);
-        }
+        c.destroy(v1);
+
+        assert(c.getObjects().size() == 3);
+        assert(c.getPtrAddresses().size() == 4);
+        assert(c.getPtrOffsets().size() == 4);
+        assert(cp1->uValue[0] == 1U);
+        assert(v2[1]->uValue[0] == 2U);
+
+        v1.clear();
+
+        assert(c.getPtrAddresses().size() == 4);
+
+        Handle<BigObject> h1 = c.makeHandle(3.0f, 3U);
+        Handle<BigObject> h2 = c.makeHandle(4.0f, 4U);
+
+        c.destroy(std::vector<Handle<BigObject>>({h1}));
+
+        assert(!c.isValid(h1));
+        assert(c.isValid(h2));
+        assert(c.getObjects().size() == 4);
+
+        c.clear();
+
+        assert(!c.isValid(h2));
+        assert(c.getObjects().size() == 0);
+        assert(c.getRefCounts().size() == 0);
+        assert(c.getObjectSlots().size() == 0);
+        assert(c.getPtrAddresses().size() == 0);
+        assert(c.getPtrOffsets().size() == 0);
+
+        Ptr<BigObject> cp3 = c.make(5.0f, 5U);
+
+        assert(cp3->uValue[0] == 5U);
+        assert(c.getPtrAddresses().size() == 1);
     }
 
-    auto t1 = std::chrono::steady_clock::now();
+    assert(c.getObjects().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+    assert(c.getPtrOffsets().size() == 0);
+}
 
-    unsigned int sumU = 0U;
-    unsigned int mulU = 1U;
-    float sumF = 0.0f;
-    float mulF = 1.0f;
+void test_container_with_fixed_capacity_arena() {
+    alignas(64) static unsigned char buffer[1 << 14];
+    MonotonicResource arena(buffer, sizeof(buffer));
 
-    for (unsigned int k = 0; k < 10U; ++k) {
-        for (unsigned int i = 0; i < count; ++i) {
-            for (unsigned int j = 0; j < 10U; ++j) {
-                sumU += v1[i]->uValue[j];
-                mulU *= v1[i]->uValue[j];
+    Container<BigObject> c(&arena, 4, 5);
 
-                sumF += v1[i]->fValue[j];
-                mulF *= v1[i]->fValue[j];
-            }
+    assert(c.getResource() == &arena);
+    assert(c.getCapacity() == 4);
+
+    size_t remaining = arena.getRemaining();
+
+    {
+        std::vector<Ptr<BigObject>> v1;
+        c.makeN(v1, 3, 1.0f, 1U);
+
+        Ptr<BigObject> cp1 = c.make(2.0f, 2U);
+        Ptr<BigObject> cp2 = cp1;
+
+        assert(arena.getRemaining() == remaining);
+
+        const unsigned char* objects = reinterpret_cast<const unsigned char*>(c.data());
+        assert(objects >= buffer && objects < buffer + sizeof(buffer));
+
+        bool thrown = false;
+        try {
+            c.makeHandle(3.0f, 3U);
+        } catch (const std::length_error&) {
+            thrown = true;
+        }
+
+        assert(thrown);
+        assert(c.getObjects().size() == 4);
+
+        thrown = false;
+        try {
+            Ptr<BigObject> cp3 = cp1;
+        } catch (const std::length_error&) {
+            thrown = true;
         }
+
+        assert(thrown);
+        assert(c.getPtrAddresses().size() == 5);
+        assert(c.getRefCounts()[3] == 2);
+
+        v1.clear();
+
+        Ptr<BigObject> cp4 = c.make(4.0f, 4U);
+
+        assert(cp4->uValue[0] == 4U);
+        assert(arena.getRemaining() == remaining);
     }
 
-    auto t2 = std::chrono::steady_clock::now();
+    assert(c.getObjects().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+
+    c.enableDirtyTracking();
+    c.setDeferredDestruction(true);
 
-    printf("\n");
-    printf("  -- sumF: %f, mulF: %f\n", (double)sumF, (double)mulF);
-    printf("  -- sumU: %d, mulU: %d\n", sumU, mulU);
-    printf("  -- execution: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count());
+    {
+        std::vector<Ptr<BigObject>> v2;
+        c.makeN(v2, 4, 5.0f, 5U);
+        v2.clear();
 
-    for (auto p : vObstruct) {
-        delete p;
+        assert(c.getPendingCount() == 4);
+        assert(c.collect() == 4);
+        assert(arena.getRemaining() == remaining);
     }
 
-    vObstruct.clear();
+    {
+        std::vector<Handle<BigObject>> handles;
+        c.makeN(handles, 4, 6.0f, 6U);
+
+        for (unsigned int i = 0; i < 4; ++i) {
+            c.get(handles[i])->uValue[0] = i;
+        }
+
+        c.clearDirty();
+        c.markDirty(handles[1]);
+
+        for (unsigned int i = 0; i < 1000; ++i) {
+            c.sort([i](const BigObject& a, const BigObject& b) {
+                return ((i & 1) != 0) ? (a.uValue[0] < b.uValue[0]) : (a.uValue[0] > b.uValue[0]);
+            });
+        }
+
+        assert(c.data()[0].uValue[0] == 0U);
+        assert(c.isDirty(handles[1]));
+        assert(!c.isDirty(handles[0]) && !c.isDirty(handles[2]) && !c.isDirty(handles[3]));
+        assert(arena.getRemaining() == remaining);
 
-    c1.invalidatePtrs();
-    v1.clear();
+        c.destroy(handles);
+    }
+
+    void* p = newDeleteResource()->allocate(100, 256);
+    assert(reinterpret_cast<uintptr_t>(p) % 256 == 0);
+    newDeleteResource()->deallocate(p, 100, 256);
 }
 
-void test_performance_compute_operations_with_non_linear_memory_with_experimental_container() {
-    unsigned int count = 200000U;
-    unsigned int countObstruct = 100U;
+void test_paged_storage_keeps_objects_in_place() {
+    Container<PagedBigObject> c;
+    size_t pageSize = Container<PagedBigObject>::Storage::kPageSize;
 
-    Container<BigObject> c1;
-    std::vector<Ptr<BigObject>> v1;
+    assert(pageSize == 512);
 
-    std::vector<BigObject*> vObstruct;
+    {
+        std::vector<Ptr<PagedBigObject>> v1;
 
-    for (unsigned int i = 0; i < count; ++i) {
-        Ptr<BigObject> p = c1.make(1.0f, 1U);
-        v1.emplace_back(p);
+        for (unsigned int i = 0; i < 1100U; ++i) {
+            v1.emplace_back(c.make(1.0f, i));
 
-        for (unsigned int i = 0; i < countObstruct; ++i) {
-            BigObject* pO = new BigObject(1.0f, 1U);
-            vObstruct.emplace_back(pO);
+            assert(v1[0]->uValue[0] == 0U);
         }
-    }
 
-    // Alteration of pointers.
-    unsigned int halfCount = count / 2U;
-    unsigned int maxIndex = count - 1U;
-    for (unsigned int i = 0; i < halfCount; ++i) {
-        if ((i & 0x01) == 0x01) {
-            continue;
+        PagedBigObject* first = v1[0].operator->();
+        PagedBigObject* last = v1[1099].operator->();
+
+        for (unsigned int i = 0; i < 1000U; ++i) {
+            v1.emplace_back(c.make(2.0f, 2U));
         }
 
-        Ptr<BigObject> tmp = v1[i];
-        v1[i] = v1[maxIndex - i];
-        v1[maxIndex - i] = tmp;
+        v1.resize(1100, v1[0]);
+
+        assert(v1[0].operator->() == first);
+        assert(v1[1099].operator->() == last);
+
+        std::vector<size_t> pages;
+        c.forEachPage([&pages](PagedBigObject*, size_t count) {
+            pages.emplace_back(count);
+        });
+
+        assert(pages.size() == 3);
+        assert(pages[0] == 512);
+        assert(pages[1] == 512);
+        assert(pages[2] == 76);
+
+        v1[1] = v1[2];
+
+        assert(c.getObjects().size() == 1099);
+        assert(v1[1099].operator->() == &(c.getObjects()[1]) );
+        assert(v1[1099]->uValue[0] == 1099U);
+        assert(v1[1]->uValue[0] == 2U);
+
+        unsigned int sumU = 0U;
+        c.forEach([&sumU](PagedBigObject& obj) {
+            sumU += obj.uValue[0];
+        });
+
+        assert(sumU == (1099U * 1100U) / 2U - 1U);
     }
 
-    auto t1 = std::chrono::steady_clock::now();
+    assert(c.getObjects().size() == 0);
+    assert(c.getPtrAddresses().size() == 0);
+}
 
-    unsigned int sumU = 0U;
-    unsigned int mulU = 1U;
-    float sumF = 0.0f;
-    float mulF = 1.0f;
+void test_concurrent_container_applies_changes_at_sync() {
+    unsigned int workerCount = 4U;
+    unsigned int count = 1000U;
 
-    for (unsigned int k = 0; k < 10U; ++k) {
-        for (unsigned int i = 0; i < count; ++i) {
-            for (unsigned int j = 0; j < 10U; ++j) {
-                sumU += v1[i]->uValue[j];
-                mulU *= v1[i]->uValue[j];
+    ConcurrentContainer<BigObject> c(workerCount);
+    std::vector<std::vector<Handle<BigObject>>> handles(workerCount);
 
-                sumF += v1[i]->fValue[j];
-                mulF *= v1[i]->fValue[j];
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&c, &handles, w, count]() {
+            for (unsigned int i = 0; i < count; ++i) {
+                handles[w].emplace_back(c.writer(w).make(1.0f, w));
             }
+        });
+    }
+
+    for (std::thread& t : workers) {
+        t.join();
+    }
+
+    workers.clear();
+
+    assert(c.size() == 0);
+    assert(c.get(handles[0][0]) == nullptr);
+
+    c.sync();
+
+    assert(c.size() == workerCount * count);
+
+    for (unsigned int w = 0; w < workerCount; ++w) {
+        for (Handle<BigObject> h : handles[w]) {
+            assert(c.get(h)->uValue[0] == w);
+            assert(c.getRefCount(h) == 1U);
         }
     }
 
-    auto t2 = std::chrono::steady_clock::now();
+    for (unsigned int w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&c, &handles, w, workerCount]() {
+            std::vector<Handle<BigObject>>& other = handles[(w + 1) % workerCount];
 
-    printf("\n");
-    printf("  -- sumF: %f, mulF: %f\n", (double)sumF, (double)mulF);
-    printf("  -- sumU: %d, mulU: %d\n", sumU, mulU);
-    printf("  -- execution: %fs\n", std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count());
+            for (Handle<BigObject> h : other) {
+                c.retain(h);
+                assert(c.get(h)->uValue[0] == (w + 1) % workerCount);
+            }
+        });
+    }
 
-    for (auto p : vObstruct) {
-        delete p;
+    for (std::thread& t : workers) {
+        t.join();
     }
 
-    vObstruct.clear();
+    workers.clear();
 
-    c1.invalidatePtrs();
-    v1.clear();
-}
+    assert(c.getRefCount(handles[0][0]) == 2U);
 
-void execute_func(const char* name, const std::function<void()>& f) {
-    auto start = std::chrono::steady_clock::now();
+    for (unsigned int w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&c, &handles, w, workerCount]() {
+            for (Handle<BigObject> h : handles[(w + 1) % workerCount]) {
+                c.writer(w).release(h);
+            }
 
-    f();
+            for (Handle<BigObject> h : handles[w]) {
+                c.writer(w).release(h);
+            }
+        });
+    }
 
-    auto finish = std::chrono::steady_clock::now();
-    double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double> >(finish - start).count();
+    for (std::thread& t : workers) {
+        t.join();
+    }
 
-    printf("%s (%fs)\n", name, elapsedSeconds);
-}
+    assert(c.size() == workerCount * count);
 
-int main() {
-    execute_func("test_create_two_elements", test_create_two_elements);
+    c.sync();
+
+    assert(c.size() == 0);
+    assert(!c.isValid(handles[0][0]));
+
+    Handle<BigObject> h1 = c.writer(0).make(2.0f, 2U);
+
+    c.sync();
+
+    Handle<BigObject> old(h1.getIndex(), 0U);
+
+    assert(h1.getIndex() < workerCount * count);
+    assert(h1.getGeneration() == 1U);
+    assert(c.get(h1)->uValue[0] == 2U);
+    assert(c.get(old) == nullptr);
+
+    c.writer(1).release(h1);
+    c.sync();
+
+    assert(c.size() == 0);
+}
+
+void test_concurrent_container_ignores_stale_and_repeated_releases() {
+    ConcurrentContainer<BigObject> c(2U);
+
+    Handle<BigObject> h1 = c.writer(0).make(1.0f, 1U);
+
+    c.retain(h1);
+    c.writer(1).release(h1);
+    assert(c.getRefCount(h1) == 0U);
+
+    c.sync();
+
+    assert(c.getRefCount(h1) == 1U);
+
+    c.writer(0).release(h1);
+    c.writer(1).release(h1);
+    c.retain(h1);
+
+    c.sync();
+
+    assert(c.size() == 0);
+    assert(!c.isValid(h1));
+
+    Handle<BigObject> h2 = c.writer(0).make(2.0f, 2U);
+    Handle<BigObject> h3 = c.writer(1).make(3.0f, 3U);
+
+    c.sync();
+
+    assert(h2.getIndex() == h1.getIndex());
+    assert(h3.getIndex() != h2.getIndex());
+    assert(c.size() == 2);
+
+    c.retain(h1);
+    c.writer(0).release(h1);
+
+    assert(c.getRefCount(h1) == 0U);
+    assert(c.getRefCount(h2) == 1U);
+
+    c.sync();
+
+    assert(c.get(h2)->uValue[0] == 2U);
+    assert(c.get(h3)->uValue[0] == 3U);
+}
+
+void test_parallel_for_each_visits_every_object_once() {
+    unsigned int count = 10000U;
+
+    ThreadPool pool(4U);
+
+    Container<BigObject> c1;
+    std::vector<Handle<BigObject>> v1;
+    c1.makeN(v1, count, 1.0f, 1U);
+
+    c1.parallelForEach(pool, [](BigObject& obj) {
+        obj.uValue[0]++;
+    }, 100U);
+
+    for (const BigObject& obj : c1) {
+        assert(obj.uValue[0] == 2U);
+    }
+
+    Container<PagedBigObject> c2;
+    std::vector<Handle<PagedBigObject>> v2;
+    c2.makeN(v2, count, 1.0f, 1U);
+
+    c2.parallelForEach(pool, [](PagedBigObject& obj) {
+        obj.uValue[0]++;
+    });
+
+    c2.forEach([](const PagedBigObject& obj) {
+        assert(obj.uValue[0] == 2U);
+    });
+
+    c1.destroy(v1[0]);
+    assert(c1.size() == count - 1);
+}
+
+void test_reorder_keeps_ptrs_and_handles_on_their_objects() {
+    unsigned int count = 6U;
+
+    Container<BigObject> c1;
+    std::vector<Ptr<BigObject>> v1;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        v1.emplace_back(c1.make(1.0f, i));
+    }
+
+    c1.reorder({5U, 4U, 3U, 2U, 1U, 0U});
+
+    for (unsigned int i = 0; i < count; ++i) {
+        assert(c1.data()[i].uValue[0] == count - 1 - i);
+        assert(v1[i]->uValue[0] == i);
+    }
+
+    bool thrown = false;
+    try {
+        c1.reorder({0U, 0U, 1U, 2U, 3U, 4U});
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    c1.sort([](const BigObject& a, const BigObject& b) {
+        return a.uValue[0] < b.uValue[0];
+    });
+
+    for (unsigned int i = 0; i < count; ++i) {
+        assert(c1.data()[i].uValue[0] == i);
+        assert(&(c1.data()[i]) == v1[i].operator->());
+    }
+
+    std::vector<Ptr<BigObject>> v2({v1[3], v1[1], v1[5]});
+    c1.reorderBy(v2);
+
+    unsigned int expected[] = {3U, 1U, 5U, 0U, 2U, 4U};
+    for (unsigned int i = 0; i < count; ++i) {
+        assert(c1.data()[i].uValue[0] == expected[i]);
+        assert(v1[expected[i]]->uValue[0] == expected[i]);
+    }
+
+    Container<ObjWithRef> c2;
+    std::vector<Handle<ObjWithRef>> v3;
+
+    for (unsigned int i = 0; i < count; ++i) {
+        v3.emplace_back(c2.makeHandle(static_cast<float>(i), v1[i]));
+    }
+
+    std::reverse(v3.begin(), v3.end());
+    c2.beginReorder(v3);
+
+    unsigned int steps = 0;
+    while (!c2.reorderStep(1)) {
+        steps++;
+    }
+
+    assert(steps == count / 2 - 1);
+
+    for (unsigned int i = 0; i < count; ++i) {
+        assert(c2.get(v3[i]) == &(c2.data()[i]));
+        assert(c2.data()[i].ptrBO->uValue[0] == count - 1 - i);
+    }
+
+    assert(c1.getPtrAddresses().size() == 2 * count + 3);
+
+    for (Handle<ObjWithRef> h : v3) {
+        c2.destroy(h);
+    }
+
+    assert(c1.getPtrAddresses().size() == count + 3);
+}
+
+void test_weak_ptr_does_not_keep_objects_alive() {
+    Container<BigObject> c;
+
+    WeakPtr<BigObject> w1;
+    assert(w1.expired());
+    assert(w1.get() == nullptr);
+
+    Ptr<BigObject> cp1 = c.make(1.0f, 1U);
+
+    {
+        Ptr<BigObject> cp2 = c.make(2.0f, 2U);
+        w1 = cp2;
+
+        std::vector<WeakPtr<BigObject>> v1(10, w1);
+
+        assert(c.getPtrAddresses().size() == 2);
+        assert(c.getRefCounts()[1] == 1U);
+        assert(v1[9] == w1);
+        assert(!w1.expired());
+        assert(w1.get()->uValue[0] == 2U);
+
+        Ptr<BigObject> cp3 = v1[5].lock();
+        assert(cp3 == cp2);
+        assert(c.getRefCounts()[1] == 2U);
+    }
+
+    assert(w1.expired());
+    assert(w1.get() == nullptr);
+    assert(c.size() == 1);
+
+    bool thrown = false;
+    try {
+        w1.lock();
+    } catch (const std::logic_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    Ptr<BigObject> cp4 = c.make(4.0f, 4U);
+    WeakPtr<BigObject> w2(cp4);
+
+    assert(w2.getHandle().getIndex() == w1.getHandle().getIndex());
+    assert(w2 != w1);
+    assert(w1.expired());
+
+    Handle<BigObject> h1 = c.makeHandle(5.0f, 5U);
+    WeakPtr<BigObject> w3(&c, h1);
+    assert(w3.get()->uValue[0] == 5U);
+
+    {
+        Ptr<BigObject> cp5 = w3.lock();
+        assert(c.getPtrAddresses().size() == 3);
+    }
+
+    assert(!w3.expired());
+
+    c.destroy(h1);
+    assert(w3.expired());
+    assert(c.size() == 2);
+    assert(cp1->uValue[0] == 1U);
+}
+
+void test_ref_borrows_objects_without_registration() {
+    Container<BigObject> c;
+
+    Ptr<BigObject> cp1 = c.make(1.0f, 1U);
+    Ptr<BigObject> cp2 = c.make(2.0f, 2U);
+    Handle<BigObject> h1 = c.makeHandle(3.0f, 3U);
+
+    unsigned long long epoch = c.getEpoch();
+
+    {
+        Ref<BigObject> r1(cp1);
+        Ref<BigObject> r2(c, h1);
+        Ref<BigObject> r3 = r1;
+
+        r1->uValue[0] = 10U;
+        (*r2).uValue[0] = 30U;
+
+        assert(r3 == r1);
+        assert(r3 != r2);
+        assert(r3.get() == cp1.operator->());
+        assert(c.getPtrAddresses().size() == 2);
+        assert(c.getRefCounts()[0] == 1U);
+    }
+
+    Ptr<BigObject> cp3 = cp2;
+    assert(c.getEpoch() == epoch);
+
+    {
+        Ptr<BigObject> cp4 = c.make(4.0f, 4U);
+        assert(c.getEpoch() != epoch);
+    }
+
+    Ref<BigObject> r4(cp2);
+    assert(r4->uValue[0] == 2U);
+    assert(cp1->uValue[0] == 10U);
+    assert(c.get(h1)->uValue[0] == 30U);
+}
+
+void test_compact_ptr_uses_the_container_of_its_type() {
+    assert(sizeof(CompactPtr<BigObject>) == 4);
+    assert(sizeof(ObjWithCompactRef) < sizeof(ObjWithRef));
+
+    Container<BigObject>& c1 = containerFor<BigObject>();
+    assert(&c1 == &containerFor<BigObject>());
+    assert(hasContainerFor<BigObject>());
+
+    size_t baseSize = c1.size();
+
+    {
+        CompactPtr<BigObject> cp1 = CompactPtr<BigObject>::make(1.0f, 1U);
+        CompactPtr<BigObject> cp2 = CompactPtr<BigObject>::make(2.0f, 2U);
+        CompactPtr<BigObject> cp3;
+
+        assert(cp3.isNull());
+        assert(c1.size() == baseSize + 2);
+        assert(c1.getPtrAddresses().empty());
+
+        {
+            Container<ObjWithCompactRef>& c2 = containerFor<ObjWithCompactRef>();
+            CompactPtr<ObjWithCompactRef> cp4 = CompactPtr<ObjWithCompactRef>::make(4.0f, cp2);
+
+            assert(c2.size() == 1);
+            assert(cp4->ptrBO == cp2);
+            assert(cp4->ptrBO->uValue[0] == 2U);
+            assert(c1.getRefCounts()[c1.getSlotOffsets()[cp2.getSlot()]] == 2U);
+        }
+
+        assert(containerFor<ObjWithCompactRef>().size() == 0);
+
+        cp3 = cp1;
+        cp1 = cp2;
+        assert((*cp3).uValue[0] == 1U);
+        assert(cp1->uValue[0] == 2U);
+
+        cp3.reset();
+        cp1 = std::move(cp2);
+
+        assert(cp2.isNull());
+        assert(c1.size() == baseSize + 1);
+        assert(cp1->uValue[0] == 2U);
+
+        std::thread t([]() {
+            assert(containerFor<BigObject>().size() == 0);
+            CompactPtr<BigObject> cp5 = CompactPtr<BigObject>::make(5.0f, 5U);
+            assert(containerFor<BigObject>().size() == 1);
+        });
+        t.join();
+
+        assert(c1.size() == baseSize + 1);
+
+        CompactPtr<BigObject> cp6 = CompactPtr<BigObject>::make(6.0f, 6U);
+        unsigned int slot = cp6.getSlot();
+
+        bool thrown = false;
+        try {
+            c1.destroy(Handle<BigObject>(slot, c1.getSlotGenerations()[slot]));
+        } catch (const std::logic_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        c1.clear();
+        assert(c1.size() == 0);
+
+        CompactPtr<BigObject> cp7 = CompactPtr<BigObject>::make(7.0f, 7U);
+        assert(cp7.getSlot() == slot);
+        assert(cp7 != cp6);
+
+        thrown = false;
+        try {
+            cp6->uValue[0] = 0U;
+        } catch (const std::logic_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        {
+            CompactPtr<BigObject> cp8 = cp6;
+            cp6.reset();
+        }
+
+        assert(cp6.isNull());
+        assert(c1.getRefCounts()[c1.getSlotOffsets()[slot]] == 1U);
+        assert(cp7->uValue[0] == 7U);
+        assert(c1.size() == 1);
+    }
+
+    assert(c1.size() == 0);
+}
+
+void test_compact_ptrs_alive_at_thread_exit() {
+    std::thread t([]() {
+        CompactPtr<ObjWithCompactRefSameType> cp1 = CompactPtr<ObjWithCompactRefSameType>::make(1.0f, CompactPtr<ObjWithCompactRefSameType>());
+        CompactPtr<ObjWithCompactRefSameType> cp2 = CompactPtr<ObjWithCompactRefSameType>::make(2.0f, cp1);
+
+        // A cycle, so both objects are still alive when the thread exits.
+        cp1->ptrSame = cp2;
+
+        assert(containerFor<ObjWithCompactRefSameType>().size() == 2);
+        assert(cp2->ptrSame->ptrSame->fValue == 2.0f);
+    });
+    t.join();
+
+    assert(containerFor<ObjWithCompactRefSameType>().size() == 0);
+}
+
+void test_handoff_of_objects_between_thread_containers() {
+    unsigned int count = 100U;
+
+    std::vector<BigObject> batch;
+
+    std::thread t([&batch, count]() {
+        Container<BigObject>& c = containerFor<BigObject>();
+        std::vector<Handle<BigObject>> handles;
+
+        for (unsigned int i = 0; i < count; ++i) {
+            handles.emplace_back(c.makeHandle(1.0f, i));
+        }
+
+        std::vector<Handle<BigObject>> odd;
+        for (unsigned int i = 1; i < count; i += 2) {
+            odd.emplace_back(handles[i]);
+        }
+
+        {
+            Ptr<BigObject> cp1 = WeakPtr<BigObject>(&c, odd[10]).lock();
+
+            bool thrown = false;
+            try {
+                c.extract(odd);
+            } catch (const std::logic_error&) {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(c.size() == count);
+            assert(cp1->uValue[0] == 21U);
+        }
+
+        {
+            Ptr<BigObject> cp2 = c.make(2.0f, 1000U);
+            std::vector<Handle<BigObject>> found;
+
+            c.forEachWithHandle([&found](Handle<BigObject> handle, BigObject& obj) {
+                if (obj.uValue[0] == 1000U) {
+                    found.emplace_back(handle);
+                }
+            });
+
+            bool thrown = false;
+            try {
+                c.extract(found);
+            } catch (const std::logic_error&) {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(c.size() == count + 1);
+            assert(cp2->uValue[0] == 1000U);
+        }
+
+        batch = c.extract(odd);
+
+        assert(c.size() == count / 2);
+        assert(!c.isValid(odd[0]));
+        assert(c.get(handles[0])->uValue[0] == 0U);
+    });
+    t.join();
+
+    assert(batch.size() == count / 2);
+
+    Container<BigObject>& c1 = containerFor<BigObject>();
+    size_t baseSize = c1.size();
+
+    std::vector<Handle<BigObject>> v1;
+    c1.adopt(std::move(batch), v1);
+
+    assert(batch.empty());
+    assert(v1.size() == count / 2);
+    assert(c1.size() == baseSize + count / 2);
+
+    for (unsigned int i = 0; i < v1.size(); ++i) {
+        assert(c1.get(v1[i])->uValue[0] == 2 * i + 1);
+    }
+
+    c1.destroy(v1);
+    assert(c1.size() == baseSize);
+}
+
+std::vector<unsigned char> read_file(const char* path) {
+    std::vector<unsigned char> bytes;
+
+    FILE* file = fopen(path, "rb");
+    assert(file != nullptr);
+
+    unsigned char buffer[4096];
+    size_t read = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    }
+
+    fclose(file);
+
+    return bytes;
+}
+
+void write_file(const char* path, const unsigned char* bytes, size_t size) {
+    FILE* file = fopen(path, "wb");
+    assert(file != nullptr);
+
+    fwrite(bytes, 1, size, file);
+    fclose(file);
+}
+
+void test_snapshot_restores_objects_and_handles() {
+    const char* path1 = "cmc_test_snapshot_1.bin";
+    const char* path2 = "cmc_test_snapshot_2.bin";
+    const char* path3 = "cmc_test_snapshot_3.bin";
+
+    std::vector<Handle<BigObject>> v1;
+    std::vector<Handle<ObjWithHandle>> v2;
+    std::vector<Handle<PagedBigObject>> v3;
+    Handle<BigObject> stale;
+
+    {
+        Container<BigObject> c1;
+        Container<ObjWithHandle> c2;
+        Container<PagedBigObject> c3;
+
+        for (unsigned int i = 0; i < 10U; ++i) {
+            v1.emplace_back(c1.makeHandle(1.0f, i));
+        }
+
+        stale = v1[3];
+        c1.destroy(stale);
+        v1[3] = c1.makeHandle(3.0f, 3U);
+        c1.destroy(v1[7]);
+
+        for (unsigned int i = 0; i < 10U; ++i) {
+            v2.emplace_back(c2.makeHandle(static_cast<float>(i), v1[i]));
+        }
+
+        c3.makeN(v3, 3000U, 1.0f, 1U);
+        c3.get(v3[2999])->uValue[0] = 2999U;
+
+        c1.save(path1);
+        c2.save(path2);
+        c3.save(path3);
+    }
+
+    Container<BigObject> d1;
+    Container<ObjWithHandle> d2;
+    Container<PagedBigObject> d3;
+
+    Ptr<BigObject> cp1 = d1.make(5.0f, 5U);
+
+    d1.load(path1);
+    d2.load(path2);
+    d3.load(path3);
+
+    assert(d1.size() == 9);
+    assert(d2.size() == 10);
+    assert(d3.size() == 3000);
+    assert(d1.getPtrAddresses().empty());
+    assert(d1.getRefCounts()[0] == 1U);
+    assert(!d1.isValid(stale));
+    assert(!d1.isValid(v1[7]));
+    assert(d3.get(v3[2999])->uValue[0] == 2999U);
+
+    for (unsigned int i = 0; i < 10U; ++i) {
+        ObjWithHandle* obj = d2.get(v2[i]);
+        assert(obj->fValue == static_cast<float>(i));
+
+        BigObject* big = d1.get(obj->handleBO);
+        assert((i == 7) ? (big == nullptr) : (big->uValue[0] == i));
+    }
+
+    Handle<BigObject> h1 = d1.makeHandle(8.0f, 8U);
+    assert(h1.getIndex() == v1[7].getIndex());
+    assert(h1.getGeneration() == v1[7].getGeneration() + 1);
+
+    bool thrown = false;
+    try {
+        d2.load(path1);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(d2.size() == 10);
+
+    std::vector<unsigned char> bytes = read_file(path1);
+    write_file(path2, bytes.data(), bytes.size() - 8);
+
+    thrown = false;
+    try {
+        d1.load(path2);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(d1.size() == 10);
+    assert(d1.isValid(h1));
+
+    size_t objectSlotsAt = (64 + 9 * sizeof(BigObject) + 63) / 64 * 64;
+    bytes[objectSlotsAt + 3] = 0x7F;
+    write_file(path2, bytes.data(), bytes.size());
+
+    thrown = false;
+    try {
+        d1.load(path2);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(d1.size() == 10);
+
+    std::remove(path1);
+    std::remove(path2);
+    std::remove(path3);
+}
+
+bool same_objects_and_slots(const Container<BigObject>& c1, const Container<BigObject>& c2) {
+    if ((c1.size() != c2.size()) ||
+        (c1.getObjectSlots() != c2.getObjectSlots()) ||
+        (c1.getSlotGenerations() != c2.getSlotGenerations())) {
+        return false;
+    }
+
+    for (size_t i = 0; i < c1.size(); ++i) {
+        if (c1.data()[i].uValue[0] != c2.data()[i].uValue[0]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void test_journal_replays_changes_into_replica() {
+    Container<BigObject> c1;
+    Container<BigObject> r1;
+    Journal<BigObject> j1(64U);
+
+    c1.addObserver(&j1);
+
+    std::vector<Handle<BigObject>> v1;
+    for (unsigned int i = 0; i < 8U; ++i) {
+        v1.emplace_back(c1.makeHandle(1.0f, i));
+    }
+
+    {
+        Ptr<BigObject> cp1 = c1.make(1.0f, 8U);
+        c1.destroy(v1[2]);
+    }
+
+    assert(j1.size() == 13);
+
+    j1.replayInto(r1);
+
+    assert(j1.size() == 0);
+    assert(same_objects_and_slots(c1, r1));
+
+    c1.get(v1[0])->uValue[0] = 100U;
+    c1.markWritten(v1[0]);
+    c1.sort([](const BigObject& a, const BigObject& b) {
+        return a.uValue[0] > b.uValue[0];
+    });
+    c1.destroy(v1[5]);
+    v1.emplace_back(c1.makeHandle(1.0f, 9U));
+
+    unsigned int moves = 0;
+    j1.consume([&moves](const Journal<BigObject>::Event& event, const BigObject* value) {
+        moves += (event.kind == Journal<BigObject>::kMove) ? 1 : 0;
+        assert((value != nullptr) == ((event.kind == Journal<BigObject>::kCreate) || (event.kind == Journal<BigObject>::kWrite)));
+    });
+    assert(moves == 1);
+
+    c1.removeObserver(&j1);
+
+    Container<BigObject> c2;
+    Container<BigObject> r2;
+
+    for (unsigned int i = 0; i < 4U; ++i) {
+        c2.makeHandle(2.0f, i);
+        r2.makeHandle(2.0f, i);
+    }
+
+    c2.addObserver(&j1);
+
+    c2.reorder({3U, 0U, 1U, 2U});
+    c2.makeHandle(3.0f, 4U);
+
+    j1.replayInto(r2);
+    assert(same_objects_and_slots(c2, r2));
+    assert(r2.data()[0].uValue[0] == 3U);
+
+    c2.clear();
+    c2.makeHandle(3.0f, 5U);
+
+    j1.replayInto(r2);
+    assert(same_objects_and_slots(c2, r2));
+
+    Journal<BigObject> j2(2U);
+    c2.addObserver(&j2);
+
+    c2.makeHandle(4.0f, 4U);
+    c2.makeHandle(5.0f, 5U);
+    assert(!j2.hasOverflowed());
+
+    c2.makeHandle(6.0f, 6U);
+    assert(j2.hasOverflowed());
+    assert(j2.size() == 2);
+
+    j2.discard();
+    assert(!j2.hasOverflowed());
+    assert(j2.size() == 0);
+
+    c2.removeObserver(&j2);
+    c2.removeObserver(&j1);
+}
+
+void test_cycle_collector_reclaims_unreachable_cycles() {
+    typedef std::vector<Ptr<ObjWithRefSameType>> PtrVector;
+
+    Container<ObjWithRefSameType> c;
+
+    Ptr<ObjWithRefSameType> root = c.make(1.0f, PtrVector());
+
+    {
+        Ptr<ObjWithRefSameType> cp1 = c.make(2.0f, PtrVector());
+        Ptr<ObjWithRefSameType> cp2 = c.make(3.0f, PtrVector({cp1, root}));
+        cp1->vPtr.push_back(cp2);
+
+        Ptr<ObjWithRefSameType> cp3 = c.make(4.0f, PtrVector());
+        cp3->vPtr.push_back(cp3);
+
+        Ptr<ObjWithRefSameType> cp4 = c.make(5.0f, PtrVector({root}));
+        root->vPtr.push_back(cp4);
+
+        assert(c.collectCycles() == 0);
+        assert(c.size() == 5);
+    }
+
+    assert(c.getRefCounts()[0] == 3U);
+
+    assert(c.collectCycles() == 3);
+    assert(c.getReclaimedCount() == 3);
+    assert(c.size() == 2);
+    assert(c.getPtrAddresses().size() == 3);
+    assert(c.getRefCounts()[0] == 2U);
+    assert(root->fValue == 1.0f);
+    assert(root->vPtr[0]->fValue == 5.0f);
+
+    Handle<ObjWithRefSameType> h = c.makeHandle(6.0f, PtrVector());
+    assert(c.collectCycles() == 0);
+    assert(c.isValid(h));
+
+    {
+        Ptr<ObjWithRefSameType> cp1 = c.make(7.0f, PtrVector());
+        cp1->vPtr.push_back(cp1);
+    }
+
+    unsigned int steps = 0;
+    while (!c.collectCyclesStep(2)) {
+        if (steps++ == 1) {
+            c.makeHandle(8.0f, PtrVector());
+        }
+    }
+
+    assert(steps > 2);
+    assert(c.getReclaimedCount() == 1);
+    assert(c.size() == 4);
+
+    root->vPtr.clear();
+    assert(c.size() == 3);
+    assert(c.collectCycles() == 0);
+}
+
+// Moving a pointer out of an object between two steps changes what the
+// counting phase saw, so the final step must find the object alive.
+void test_cycle_collector_keeps_objects_whose_ptrs_move() {
+    typedef std::vector<Ptr<ObjWithRefSameType>> PtrVector;
+
+    Container<ObjWithRefSameType> c;
+
+    {
+        Ptr<ObjWithRefSameType> cp1 = c.make(1.0f, PtrVector());
+        Ptr<ObjWithRefSameType> cp2 = c.make(2.0f, PtrVector({cp1}));
+        cp1->vPtr.push_back(cp2);
+    }
+
+    assert(!c.collectCyclesStep(2));
+
+    Ptr<ObjWithRefSameType> keep = std::move(c.data()[0].vPtr[0]);
+
+    while (!c.collectCyclesStep(2)) {
+    }
+
+    assert(c.getReclaimedCount() == 0);
+    assert(c.size() == 2);
+    assert(keep->fValue == 2.0f);
+    assert(keep->vPtr[0]->fValue == 1.0f);
+
+    Container<ObjWithRefSameType> c2;
+
+    {
+        Ptr<ObjWithRefSameType> cp1 = c2.make(1.0f, PtrVector());
+        Ptr<ObjWithRefSameType> cp2 = c2.make(2.0f, PtrVector({cp1}));
+        cp1->vPtr.push_back(cp2);
+    }
+
+    // Both objects are listed as garbage, only the final check is left.
+    assert(!c2.collectCyclesStep(12));
+
+    Ptr<ObjWithRefSameType> keep2 = std::move(c2.data()[1].vPtr[0]);
+
+    assert(c2.collectCyclesStep(1));
+    assert(c2.getReclaimedCount() == 0);
+    assert(c2.size() == 2);
+    assert(keep2->fValue == 1.0f);
+    assert(keep2->vPtr[0]->fValue == 2.0f);
+}
+
+// Pointer copies and destructions between steps used to restart the pass,
+// so a steady stream of them kept it from ever finishing.
+void test_cycle_collector_finishes_while_the_container_changes() {
+    typedef std::vector<Ptr<ObjWithRefSameType>> PtrVector;
+
+    Container<ObjWithRefSameType> c;
+
+    Ptr<ObjWithRefSameType> root = c.make(1.0f, PtrVector());
+
+    std::vector<Handle<ObjWithRefSameType>> handles;
+    for (unsigned int i = 0; i < 10; ++i) {
+        handles.push_back(c.makeHandle(2.0f, PtrVector()));
+    }
+
+    for (unsigned int i = 0; i < 50; ++i) {
+        Ptr<ObjWithRefSameType> cp1 = c.make(3.0f, PtrVector());
+        Ptr<ObjWithRefSameType> cp2 = c.make(4.0f, PtrVector({cp1, root}));
+        cp1->vPtr.push_back(cp2);
+    }
+
+    assert(c.size() == 111);
+
+    unsigned int steps = 0;
+    while (!c.collectCyclesStep(4)) {
+        Ptr<ObjWithRefSameType> cp3 = root;
+        Ptr<ObjWithRefSameType> cp4 = std::move(cp3);
+        root->vPtr.push_back(cp4);
+        root->vPtr.pop_back();
+
+        if (((steps % 10) == 0) && (steps / 10 < handles.size())) {
+            c.destroy(handles[steps / 10]);
+        }
+
+        steps++;
+        assert(steps < 1000);
+    }
+
+    assert(steps > 100);
+    assert(c.getReclaimedCount() == 100);
+    assert(c.size() == 1);
+    assert(c.getRefCounts()[0] == 1U);
+    assert(root->fValue == 1.0f);
+}
+
+void test_dirty_tracking_follows_objects_through_compaction() {
+    Container<BigObject> c;
+
+    std::vector<Handle<BigObject>> handles;
+    for (unsigned int i = 0; i < 100; ++i) {
+        handles.push_back(c.makeHandle(1.0f, i));
+    }
+
+    c.enableDirtyTracking();
+    assert(!c.isDirty(handles[0]));
+
+    unsigned int visited = 0;
+    c.forEachDirty([&visited](BigObject&) { visited++; });
+    assert(visited == 0);
+
+    c.get(handles[3])->fValue[0] = 2.0f;
+    c.get(handles[70])->fValue[0] = 2.0f;
+    c.markDirty(handles[99]);
+
+    Handle<BigObject> h1 = c.makeHandle(3.0f, 100U);
+    assert(c.isDirty(handles[3]));
+    assert(c.isDirty(handles[70]));
+    assert(!c.isDirty(handles[4]));
+
+    // The last object moves into the hole and takes its bit along.
+    c.destroy(handles[3]);
+    assert(!c.isValid(handles[3]));
+    assert(c.isDirty(h1));
+    assert(c.isDirty(handles[99]));
+
+    c.destroy(handles[70]);
+    assert(c.isDirty(handles[99]));
+
+    std::vector<unsigned int> values;
+    c.forEachDirty([&values](BigObject& obj) { values.push_back(obj.uValue[0]); });
+    assert(values.size() == 2);
+    assert((values[0] == 100U) && (values[1] == 99U));
+
+    c.sort([](const BigObject& a, const BigObject& b) { return a.uValue[0] < b.uValue[0]; });
+    values.clear();
+    c.forEachDirty([&values](BigObject& obj) { values.push_back(obj.uValue[0]); });
+    assert(values.size() == 2);
+    assert((values[0] == 99U) && (values[1] == 100U));
+
+    Ptr<BigObject> cp1 = c.make(4.0f, 101U);
+    c.clearDirty();
+    assert(!c.isDirty(handles[99]));
+
+    cp1->fValue[0] = 5.0f;
+    values.clear();
+    c.forEachDirty([&values](BigObject& obj) { values.push_back(obj.uValue[0]); });
+    assert(values.size() == 1);
+    assert(values[0] == 101U);
+
+    c.disableDirtyTracking();
+    c.get(handles[0])->fValue[0] = 6.0f;
+    assert(!c.isDirty(handles[0]));
+}
+
+void test_deferred_destruction_waits_for_collect() {
+    typedef std::vector<Ptr<ObjWithRefSameType>> PtrVector;
+
+    Container<ObjWithRefSameType> c;
+    c.setDeferredDestruction(true);
+    assert(c.isDestructionDeferred());
+
+    Ptr<ObjWithRefSameType> cp1 = c.make(1.0f, PtrVector());
+    WeakPtr<ObjWithRefSameType> w1;
+    WeakPtr<ObjWithRefSameType> w2;
+
+    {
+        Ptr<ObjWithRefSameType> cp2 = c.make(2.0f, PtrVector());
+        Ptr<ObjWithRefSameType> cp3 = c.make(3.0f, PtrVector({cp2}));
+        Ptr<ObjWithRefSameType> cp4 = c.make(4.0f, PtrVector());
+        w1 = cp3;
+        w2 = cp4;
+    }
+
+    assert(c.size() == 4);
+    assert(c.getPtrAddresses().size() == 2);
+    assert(c.getPendingCount() == 2);
+    assert(!w1.expired());
+    assert(w1.get()->fValue == 3.0f);
+
+    Ptr<ObjWithRefSameType> cp4 = w2.lock();
+
+    // The object of cp3 releases cp2 when destroyed, which is collected in
+    // the same call.
+    assert(c.collect() == 2);
+    assert(c.size() == 2);
+    assert(c.getPendingCount() == 0);
+    assert(w1.expired());
+    assert(!w2.expired());
+    assert(cp1->fValue == 1.0f);
+    assert(cp4->fValue == 4.0f);
+
+    {
+        Ptr<ObjWithRefSameType> cp5 = c.make(5.0f, PtrVector({cp1}));
+    }
+
+    assert(c.size() == 3);
+    assert(c.getRefCounts()[0] == 2U);
+
+    c.setDeferredDestruction(false);
+    assert(c.size() == 2);
+    assert(c.getRefCounts()[0] == 1U);
+
+    {
+        Ptr<ObjWithRefSameType> cp6 = c.make(6.0f, PtrVector());
+    }
+
+    assert(c.size() == 2);
+    assert(c.collect() == 0);
+}
+
+void test_indexes_follow_creations_and_destructions() {
+    Container<BigObject> c;
+
+    std::vector<Handle<BigObject>> handles;
+    for (unsigned int i = 0; i < 50; ++i) {
+        handles.push_back(c.makeHandle(1.0f, i * 2U));
+    }
+
+    HashIndex<BigObject, unsigned int, BigObjectKey> hashIndex(c);
+    SortedIndex<BigObject, unsigned int, BigObjectKey> sortedIndex(c);
+
+    for (unsigned int i = 50; i < 100; ++i) {
+        handles.push_back(c.makeHandle(1.0f, i * 2U));
+    }
+
+    assert(hashIndex.size() == 100);
+    assert(sortedIndex.size() == 100);
+    assert(hashIndex.find(40U) == handles[20]);
+    assert(sortedIndex.find(160U) == handles[80]);
+    assert(!hashIndex.contains(41U));
+    assert(!sortedIndex.contains(41U));
+    assert(hashIndex.find(41U).getIndex() == Handle<BigObject>::kInvalidIndex);
+
+    {
+        Ptr<BigObject> cp1 = hashIndex.at(40U);
+        assert(cp1->uValue[0] == 40U);
+        assert(c.getRefCounts()[20] == 2U);
+
+        Ptr<BigObject> cp2 = sortedIndex.at(40U);
+        assert(cp2 == cp1);
+    }
+
+    bool thrown = false;
+    try {
+        hashIndex.at(41U);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Destroying compacts the array, which the indexes do not notice since
+    // they store slots.
+    for (unsigned int i = 0; i < 100; i += 3) {
+        c.destroy(handles[i]);
+    }
+
+    assert(hashIndex.size() == 66);
+    assert(sortedIndex.size() == 66);
+    assert(!hashIndex.contains(0U));
+    assert(!sortedIndex.contains(198U));
+    assert(hashIndex.find(196U) == handles[98]);
+    assert(sortedIndex.find(196U) == handles[98]);
+
+    std::vector<unsigned int> keys;
+    sortedIndex.forEachInRange(10U, 20U, [&](Handle<BigObject> h) { keys.push_back(c.get(h)->uValue[0]); });
+    assert(keys.size() == 3);
+    assert((keys[0] == 10U) && (keys[1] == 14U) && (keys[2] == 16U));
+
+    c.sort([](const BigObject& a, const BigObject& b) { return a.uValue[0] > b.uValue[0]; });
+    assert(c.get(hashIndex.find(2U))->uValue[0] == 2U);
+
+    c.get(handles[1])->uValue[0] = 1001U;
+    c.markWritten(handles[1]);
+    assert(!hashIndex.contains(2U));
+    assert(!sortedIndex.contains(2U));
+    assert(hashIndex.find(1001U) == handles[1]);
+    assert(sortedIndex.find(1001U) == handles[1]);
+
+    Handle<BigObject> h1 = c.makeHandle(1.0f, 3U);
+    assert(hashIndex.find(3U) == h1);
+    assert(sortedIndex.find(3U) == h1);
+
+    c.clear();
+    assert(hashIndex.size() == 0);
+    assert(sortedIndex.size() == 0);
+    assert(!hashIndex.contains(3U));
+
+    Handle<BigObject> h2 = c.makeHandle(1.0f, 3U);
+    assert(hashIndex.find(3U) == h2);
+    assert(sortedIndex.find(3U) == h2);
+}
+
+// Keys that are multiples of the table size share every bit a mask of the
+// hash would keep, so they must still be spread by the index.
+void test_hash_index_spreads_keys_sharing_low_bits() {
+    Container<BigObject> c;
+    HashIndex<BigObject, unsigned int, BigObjectKey> hashIndex(c);
+
+    std::vector<Handle<BigObject>> handles;
+    for (unsigned int i = 0; i < 1000; ++i) {
+        handles.push_back(c.makeHandle(1.0f, i * 4096U));
+    }
+
+    assert(hashIndex.size() == 1000);
+    assert(hashIndex.getMaxProbeLength() < 16);
+
+    for (unsigned int i = 0; i < 1000; ++i) {
+        assert(hashIndex.find(i * 4096U) == handles[i]);
+        assert(!hashIndex.contains(i * 4096U + 1U));
+    }
+
+    for (unsigned int i = 0; i < 1000; i += 2) {
+        c.destroy(handles[i]);
+    }
+
+    assert(hashIndex.size() == 500);
+    assert(!hashIndex.contains(0U));
+    assert(hashIndex.find(4096U) == handles[1]);
+}
+
+void test_query_kernels_agree_with_scalar_comparisons() {
+    Container<BigObject> c;
+
+    std::vector<Handle<BigObject>> handles;
+    for (unsigned int i = 0; i < 1000; ++i) {
+        handles.push_back(c.makeHandle(static_cast<float>(i % 37) - 18.0f, i % 101));
+    }
+
+    for (unsigned int i = 0; i < 1000; i += 7) {
+        c.destroy(handles[i]);
+    }
+
+    c.get(handles[1])->fValue[0] = std::numeric_limits<float>::quiet_NaN();
+    c.get(handles[2])->uValue[0] = 0x80000001U;
+
+    std::vector<unsigned int> greater;
+    for (size_t i = 0; i < c.size(); ++i) {
+        if (c.getObjects()[i].uValue[0] > 50U) {
+            greater.push_back(static_cast<unsigned int>(i));
+        }
+    }
+
+    const CompareOp ops[] = {kLess, kLessEqual, kGreater, kGreaterEqual, kEqual, kNotEqual};
+    QueryKernel best = getQueryKernel();
+
+    for (CompareOp op : ops) {
+        Where<float> whereF(offsetof(BigObject, fValue), op, 3.0f);
+        Where<unsigned int> whereU(offsetof(BigObject, uValue), op, 50U);
+        Where<int> whereI(offsetof(BigObject, uValue), op, 50);
+
+        setQueryKernel(kScalarKernel);
+
+        std::vector<unsigned int> expectedF;
+        std::vector<unsigned int> expectedU;
+        std::vector<unsigned int> expectedI;
+        filter(c, whereF, expectedF);
+        filter(c, whereU, expectedU);
+        filter(c, whereI, expectedI);
+
+        if (op == kGreater) {
+            assert(expectedU == greater);
+            assert(expectedI.size() == greater.size() - 1);
+        }
+
+        for (int kernel = kScalarKernel; kernel <= best; ++kernel) {
+            setQueryKernel(static_cast<QueryKernel>(kernel));
+
+            std::vector<unsigned int> positionsF;
+            std::vector<unsigned int> positionsU;
+            std::vector<unsigned int> positionsI;
+            filter(c, whereF, positionsF);
+            filter(c, whereU, positionsU);
+            filter(c, whereI, positionsI);
+
+            assert(positionsF == expectedF);
+            assert(positionsU == expectedU);
+            assert(positionsI == expectedI);
+            assert(countIf(c, whereU) == expectedU.size());
+        }
+    }
+
+    setQueryKernel(best);
+    assert(getQueryKernel() == best);
+
+    std::vector<Handle<BigObject>> selected;
+    selectInto(c, Where<unsigned int>(offsetof(BigObject, uValue), kGreater, 50U), selected);
+    assert(selected.size() == greater.size());
+
+    unsigned int sumU = 0U;
+    for (Handle<BigObject> h : selected) {
+        assert(c.get(h)->uValue[0] > 50U);
+        sumU += c.get(h)->uValue[0];
+    }
+
+    Where<unsigned int> whereU(offsetof(BigObject, uValue), kGreater, 50U);
+    assert(reduce<unsigned int>(c, offsetof(BigObject, uValue), whereU) == sumU);
+
+    Container<float> cf;
+    for (unsigned int i = 0; i < 100; ++i) {
+        cf.makeHandle(static_cast<float>(i));
+    }
+
+    for (int kernel = kScalarKernel; kernel <= best; ++kernel) {
+        setQueryKernel(static_cast<QueryKernel>(kernel));
+        assert(countIf(cf, Where<float>(0, kLess, 10.5f)) == 11);
+    }
+
+    setQueryKernel(best);
+
+    bool thrown = false;
+    try {
+        countIf(c, Where<float>(sizeof(BigObject), kLess, 1.0f));
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void test_two_objects_within_circular_reference_still_leak() {
+    Container<ObjWithRefSameType> c;
+
+    {
+        Ptr<ObjWithRefSameType> cp1 = c.make(1.0f, std::vector<Ptr<ObjWithRefSameType>>());
+        Ptr<ObjWithRefSameType> cp2 = c.make(1.0f, std::vector<Ptr<ObjWithRefSameType>>({cp1}));
+        cp1->vPtr.push_back(cp2);
+
+        assert(c.getObjects().size() == 2);
+        assert(c.getRefCounts().size() == 2);
+        assert(c.getPtrAddresses().size() == 4);
+        assert(c.getPtrOffsets().size() == 4);
+    }
+
+    assert(c.getObjects().size() == 2);
+    assert(c.getRefCounts().size() == 2);
+    assert(c.getPtrAddresses().size() == 2);
+    assert(c.getPtrOffsets().size() == 2);
+}
+
+void execute_func(const char* name, const std::function<void()>& f) {
+    auto start = std::chrono::steady_clock::now();
+
+    f();
+
+    auto finish = std::chrono::steady_clock::now();
+    double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double> >(finish - start).count();
+
+    printf("%s (%fs)\n", name, elapsedSeconds);
+}
+
+int main() {
+    execute_func("test_create_two_elements", test_create_two_elements);
     execute_func("test_assign_two_elements", test_assign_two_elements);
     execute_func("test_equal_two_elements", test_equal_two_elements);
     execute_func("test_not_equal_two_elements", test_not_equal_two_elements);
@@ -636,11 +2276,37 @@ int main() {
     execute_func("test_one_element_two_pointer_and_third_deleted_first", test_one_element_two_pointer_and_third_deleted_first);
     execute_func("test_create_object_with_ptr_to_other_object", test_create_object_with_ptr_to_other_object);
     execute_func("test_create_ptr_of_object_and_add_it_to_vector", test_create_ptr_of_object_and_add_it_to_vector);
+    execute_func("test_remove_first_element_moves_last_one_into_its_slot", test_remove_first_element_moves_last_one_into_its_slot);
+    execute_func("test_handles_detect_reused_slots_with_generation", test_handles_detect_reused_slots_with_generation);
+    execute_func("test_destroying_a_handle_referenced_by_a_ptr_throws", test_destroying_a_handle_referenced_by_a_ptr_throws);
+    execute_func("test_destroying_a_handle_found_through_an_index_throws", test_destroying_a_handle_found_through_an_index_throws);
+    execute_func("test_dense_iteration_over_objects", test_dense_iteration_over_objects);
+    execute_func("test_soa_container_compacts_all_columns", test_soa_container_compacts_all_columns);
+    execute_func("test_archetype_queries_components_in_lockstep", test_archetype_queries_components_in_lockstep);
+    execute_func("test_compaction_moves_objects_holding_ptrs", test_compaction_moves_objects_holding_ptrs);
+    execute_func("test_move_and_cross_container_assignment", test_move_and_cross_container_assignment);
+    execute_func("test_bulk_creation_of_ptrs_and_handles", test_bulk_creation_of_ptrs_and_handles);
+    execute_func("test_bulk_destruction_and_clear", test_bulk_destruction_and_clear);
+    execute_func("test_container_with_fixed_capacity_arena", test_container_with_fixed_capacity_arena);
+    execute_func("test_paged_storage_keeps_objects_in_place", test_paged_storage_keeps_objects_in_place);
+    execute_func("test_concurrent_container_applies_changes_at_sync", test_concurrent_container_applies_changes_at_sync);
+    execute_func("test_concurrent_container_ignores_stale_and_repeated_releases", test_concurrent_container_ignores_stale_and_repeated_releases);
+    execute_func("test_parallel_for_each_visits_every_object_once", test_parallel_for_each_visits_every_object_once);
+    execute_func("test_reorder_keeps_ptrs_and_handles_on_their_objects", test_reorder_keeps_ptrs_and_handles_on_their_objects);
+    execute_func("test_weak_ptr_does_not_keep_objects_alive", test_weak_ptr_does_not_keep_objects_alive);
+    execute_func("test_ref_borrows_objects_without_registration", test_ref_borrows_objects_without_registration);
+    execute_func("test_compact_ptr_uses_the_container_of_its_type", test_compact_ptr_uses_the_container_of_its_type);
+    execute_func("test_compact_ptrs_alive_at_thread_exit", test_compact_ptrs_alive_at_thread_exit);
+    execute_func("test_handoff_of_objects_between_thread_containers", test_handoff_of_objects_between_thread_containers);
+    execute_func("test_snapshot_restores_objects_and_handles", test_snapshot_restores_objects_and_handles);
+    execute_func("test_journal_replays_changes_into_replica", test_journal_replays_changes_into_replica);
+    execute_func("test_cycle_collector_reclaims_unreachable_cycles", test_cycle_collector_reclaims_unreachable_cycles);
+    execute_func("test_cycle_collector_keeps_objects_whose_ptrs_move", test_cycle_collector_keeps_objects_whose_ptrs_move);
+    execute_func("test_cycle_collector_finishes_while_the_container_changes", test_cycle_collector_finishes_while_the_container_changes);
+    execute_func("test_dirty_tracking_follows_objects_through_compaction", test_dirty_tracking_follows_objects_through_compaction);
+    execute_func("test_deferred_destruction_waits_for_collect", test_deferred_destruction_waits_for_collect);
+    execute_func("test_indexes_follow_creations_and_destructions", test_indexes_follow_creations_and_destructions);
+    execute_func("test_hash_index_spreads_keys_sharing_low_bits", test_hash_index_spreads_keys_sharing_low_bits);
+    execute_func("test_query_kernels_agree_with_scalar_comparisons", test_query_kernels_agree_with_scalar_comparisons);
     execute_func("test_two_objects_within_circular_reference_still_leak", test_two_objects_within_circular_reference_still_leak);
-
-    execute_func("test_performance_many_creations_with_regular_vector_and_pointers", test_performance_many_creations_with_regular_vector_and_pointers);
-    execute_func("test_performance_many_creations_with_experimental_container", test_performance_many_creations_with_experimental_container);
-    execute_func("test_performance_compute_operations_with_non_linear_memory_with_regular_vector_and_pointers", test_performance_compute_operations_with_non_linear_memory_with_regular_vector_and_pointers);
-    execute_func("test_performance_compute_operations_with_linear_memory_with_experimental_container", test_performance_compute_operations_with_linear_memory_with_experimental_container);
-    execute_func("test_performance_compute_operations_with_non_linear_memory_with_experimental_container", test_performance_compute_operations_with_non_linear_memory_with_experimental_container);
 }